@@ -0,0 +1,368 @@
+/** 
+  ******************************************************************************
+  *  @file   main.cpp
+  *  @brief  Benchmarks of magnesium actor framework on QEMU lm3s6965evb.
+  *          Results are printed via semihosting, the run ends with exit.
+  ******************************************************************************
+  *  License: Public domain.
+  *****************************************************************************/
+
+#include <optional>
+#include "magnesium.hpp"
+
+using namespace magnesium;
+
+void operator delete(void*) {}  // all objects are persistent
+
+const unsigned int ACTOR_VECTOR = 48;    // lines not wired in QEMU's model
+const unsigned int WORK_VECTOR = 49;
+const unsigned int PRODUCER_VECTOR = 50;
+const unsigned int NOTIFY_VECTOR = 51;
+const unsigned int ITERATIONS = 1000;
+
+#define NVIC_ISER_ADDR ((volatile unsigned int*) 0xE000E100)
+#define NVIC_IPR_ADDR ((volatile unsigned char*) 0xE000E400)
+
+#define SYS_WRITE0 0x04U
+#define SYS_EXIT 0x18U
+#define ADP_STOPPED_APPLICATION_EXIT 0x20026U
+#define ADP_STOPPED_INTERNAL_ERROR 0x20024U
+
+static void nvic_setup(unsigned int vect, unsigned int prio) {
+    NVIC_IPR_ADDR[vect] = prio << (8 - MG_NVIC_PRIO_BITS);
+    NVIC_ISER_ADDR[vect / 32] = 1U << (vect % 32);
+}
+
+static void semihost(unsigned int op, const void* arg) {
+    register unsigned int r0 asm("r0") = op;
+    register const void* r1 asm("r1") = arg;
+    asm volatile ("bkpt 0xab" : "+r" (r0) : "r" (r1) : "memory");
+}
+
+static void semihost_exit(unsigned int reason) {
+    semihost(SYS_EXIT, reinterpret_cast<const void*>(reason));
+    for(;;);
+}
+
+static void panic() {
+    asm volatile ("cpsid i");
+    semihost(SYS_WRITE0, "panic\n");
+    semihost_exit(ADP_STOPPED_INTERNAL_ERROR);
+}
+
+extern "C" void HardFault_Handler() {
+    panic();
+}
+
+void* magnesium::future::promise_type::allocate(std::size_t n) {
+    static uint8_t buffer[512];
+    static std::size_t ptr = 0;
+    const std::size_t old_ptr = ptr;
+    ptr += n;
+    
+    if (ptr > sizeof(buffer)) {
+        panic();
+    }
+    
+    return buffer + old_ptr;
+}
+
+static char* append(char* p, const char* s) {
+    while (*s) {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+static char* append(char* p, unsigned int n) {
+    char digits[10];
+    unsigned int len = 0;
+
+    do {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+
+    while (len) {
+        *p++ = digits[--len];
+    }
+    return p;
+}
+
+/*
+ * Runs the body and prints SysTick ticks it took. Under -icount the tick 
+ * count depends only on the executed instructions so results of two runs 
+ * of the same binary are identical.
+ */
+template<class F> static void bench(const char* name, F body) {
+    char line[80];
+    const unsigned int start = mg_port_timestamp();
+
+    body();
+
+    const unsigned int ticks = (mg_port_timestamp() - start) >> MG_TIMESTAMP_SHIFT;
+    char* p = append(line, name);
+    p = append(p, ": ");
+    p = append(p, ticks);
+    p = append(p, " ticks, ");
+    p = append(p, ticks / ITERATIONS);
+    p = append(p, " per op\n");
+    *p = 0;
+    semihost(SYS_WRITE0, line);
+}
+
+/*
+ * ISR-to-actor latency: from the request of the source interrupt to the 
+ * resumption of the actor, in SysTick ticks.
+ */
+static struct latency {
+    unsigned int start;
+    unsigned int count;
+    unsigned int total;
+    unsigned int max;
+
+    void record() {
+        const unsigned int ticks = (mg_port_timestamp() - start) >> MG_TIMESTAMP_SHIFT;
+        ++count;
+        total += ticks;
+        max = ticks > max ? ticks : max;
+    }
+
+    void print(const char* name) const {
+        char line[80];
+        char* p = append(line, name);
+        p = append(p, " latency: ");
+        p = append(p, count ? total / count : 0);
+        p = append(p, " ticks avg, ");
+        p = append(p, max);
+        p = append(p, " max\n");
+        *p = 0;
+        semihost(SYS_WRITE0, line);
+    }
+} g_latency;
+
+static struct bench_msg : public message {
+    unsigned int value;
+} g_msgs[4];
+
+constinit static message_pool g_pool(g_msgs);
+constinit static static_pool<bench_msg, 4> g_static_pool;
+#if defined MG_LOCKFREE_POOL
+static bench_msg g_isr_msgs[4];
+constinit static lockfree_pool g_isr_pool(g_isr_msgs);
+#endif
+constinit static queue<bench_msg> g_queue;
+constinit static queue<bench_msg> g_ping;
+constinit static queue<bench_msg> g_pong;
+static unsigned int g_work_calls = 0;
+
+/*
+ * Allocation paths are kept out of line so that 'make size' lists the code
+ * size of each next to the cycles of the benches calling them.
+ */
+__attribute__((noinline)) static owner<bench_msg> lazy_pool_alloc() {
+    return g_pool.alloc();
+}
+
+__attribute__((noinline)) static owner<bench_msg> static_pool_alloc() {
+    return g_static_pool.alloc();
+}
+
+#if defined MG_LOCKFREE_POOL
+__attribute__((noinline)) static owner<bench_msg> lockfree_pool_alloc() {
+    return g_isr_pool.alloc();
+}
+#endif
+
+/*
+ * The same allocation returned as std::optional<owner>, the way the
+ * internals returned it before owner became nullable. The difference from
+ * lazy_pool_alloc() is the cost at one call boundary, the old code paid it
+ * at every layer.
+ */
+__attribute__((noinline)) static std::optional<owner<bench_msg>> optional_pool_alloc() {
+    auto msg = g_pool.alloc();
+
+    if (!msg) {
+        return std::nullopt;
+    }
+    return std::optional<owner<bench_msg>>(std::move(msg));
+}
+
+class consumer_actor : public static_actor<consumer_actor> {
+public:
+    consumer_actor(unsigned int vect) noexcept : static_actor(vect) {}
+
+    future run() {
+        for(;;) {
+            auto msg = co_await poll(g_queue);
+            g_latency.record();
+        }
+    }
+};
+
+class ping_actor : public static_actor<ping_actor> {
+public:
+    ping_actor(unsigned int vect) noexcept : static_actor(vect) {}
+
+    future run() {
+        for(;;) {
+            auto msg = co_await poll(g_ping);
+
+            if (--msg->value) {
+                g_pong.push(msg);
+            }
+        }
+    }
+};
+
+class pong_actor : public static_actor<pong_actor> {
+public:
+    pong_actor(unsigned int vect) noexcept : static_actor(vect) {}
+
+    future run() {
+        for(;;) {
+            auto msg = co_await poll(g_pong);
+            g_ping.push(msg);
+        }
+    }
+};
+
+// Waits for the interrupt itself, the handler only notifies.
+class irq_actor : public static_actor<irq_actor> {
+public:
+    irq_actor(unsigned int vect) noexcept : static_actor(vect) {}
+
+    future run() {
+        for(;;) {
+            co_await irq<NOTIFY_VECTOR>();
+            g_latency.record();
+        }
+    }
+};
+
+static consumer_actor g_consumer(ACTOR_VECTOR);
+static irq_actor g_irq_actor(ACTOR_VECTOR);
+static ping_actor g_ping_actor(ACTOR_VECTOR);
+static pong_actor g_pong_actor(ACTOR_VECTOR);
+static work_item g_work(WORK_VECTOR, [](work_item&) { ++g_work_calls; });
+
+extern "C" void IRQ48_Handler() {
+    scheduler::schedule(ACTOR_VECTOR);
+}
+
+extern "C" void IRQ49_Handler() {
+    scheduler::schedule(WORK_VECTOR);
+}
+
+// Interrupt source more urgent than the actors, allocates in the handler.
+extern "C" void IRQ50_Handler() {
+#if defined MG_LOCKFREE_POOL
+    auto msg = g_isr_pool.alloc();
+#else
+    auto msg = g_pool.alloc();
+#endif
+
+    if (msg) {
+        g_queue.push(msg);
+    }
+}
+
+extern "C" void IRQ51_Handler() {
+    interrupt<NOTIFY_VECTOR>::notify();
+}
+
+extern "C" int main() {
+    mg_port_timestamp_init();
+#if defined MG_STACK_STATS
+    scheduler::paint_stack();
+#endif
+    nvic_setup(ACTOR_VECTOR, 1);
+    nvic_setup(WORK_VECTOR, 1);
+    nvic_setup(PRODUCER_VECTOR, 0);
+    nvic_setup(NOTIFY_VECTOR, 0);
+    asm volatile ("cpsie i");
+
+    g_consumer.start();
+    g_ping_actor.start();
+    g_pong_actor.start();
+    g_irq_actor.start();
+
+    bench("pool alloc/free", [] {
+        for (unsigned int i = 0; i < ITERATIONS; ++i) {
+            auto msg = lazy_pool_alloc();
+        }
+    });
+
+    bench("pool alloc/free as optional<owner>", [] {
+        for (unsigned int i = 0; i < ITERATIONS; ++i) {
+            auto msg = optional_pool_alloc();
+        }
+    });
+
+    bench("static pool alloc/free", [] {
+        for (unsigned int i = 0; i < ITERATIONS; ++i) {
+            auto msg = static_pool_alloc();
+        }
+    });
+
+#if defined MG_LOCKFREE_POOL
+    bench("lock-free pool alloc/free", [] {
+        for (unsigned int i = 0; i < ITERATIONS; ++i) {
+            auto msg = lockfree_pool_alloc();
+        }
+    });
+#endif
+
+    bench("alloc in thread, free in actor", [] {
+        for (unsigned int i = 0; i < ITERATIONS; ++i) {
+            auto msg = g_pool.alloc();
+            g_queue.push(msg);
+        }
+    });
+
+    g_latency = {};
+    bench("alloc in ISR, free in actor", [] {
+        for (unsigned int i = 0; i < ITERATIONS; ++i) {
+            g_latency.start = mg_port_timestamp();
+            pic_interrupt_request(PRODUCER_VECTOR);
+        }
+    });
+    g_latency.print("alloc+push in ISR");
+
+    if (g_latency.count != ITERATIONS) {
+        panic();
+    }
+
+    g_latency = {};
+    bench("irq notify to actor", [] {
+        for (unsigned int i = 0; i < ITERATIONS; ++i) {
+            g_latency.start = mg_port_timestamp();
+            pic_interrupt_request(NOTIFY_VECTOR);
+        }
+    });
+    g_latency.print("irq notify");
+
+    if (g_latency.count != ITERATIONS) {
+        panic();
+    }
+
+    bench("same priority handoff", [] {
+        auto msg = g_pool.alloc();
+        msg->value = ITERATIONS;
+        g_ping.push(msg);
+    });
+
+    bench("work item post", [] {
+        for (unsigned int i = 0; i < ITERATIONS; ++i) {
+            g_work.post();
+        }
+    });
+
+    if (g_work_calls != ITERATIONS) {
+        panic();
+    }
+
+    semihost_exit(ADP_STOPPED_APPLICATION_EXIT);
+    return 0;
+}
@@ -0,0 +1,59 @@
+/** 
+  * @file  mg_port.h
+  * License: Public domain. The code is provided as is without any warranty.
+  */
+#ifndef _MG_PORT_H_
+#define _MG_PORT_H_
+
+#if !defined (__GNUC__)
+#error This header is intended to be used in GNU GCC only because of non-portable asm functions. 
+#endif
+
+#if !defined MG_NVIC_PRIO_BITS
+#error Define MG_NVIC_PRIO_BITS as maximum number of supported preemption priorities for the target chip.
+#endif
+
+#if !defined MG_PRIO_MAX
+#define MG_PRIO_MAX (1U << MG_NVIC_PRIO_BITS)
+#endif 
+
+#if !defined MG_TIMERQ_MAX
+#define MG_TIMERQ_MAX 10
+#endif
+
+#define mg_port_clz(x) __builtin_clz(x)
+
+#define mg_object_lock(p) { asm volatile ("cpsid i"); }
+#define mg_object_unlock(p) { asm volatile ("cpsie i"); }
+#define mg_port_sleep() { asm volatile ("wfi"); }
+
+extern "C" unsigned int _ebss[], _estack[]; // see gcc.ld
+#define mg_port_stack_limit() (_ebss)
+#define mg_port_stack_top() (_estack)
+#define mg_port_stack_pointer() \
+    ({ unsigned int* sp; asm volatile ("mov %0, sp" : "=r" (sp)); sp; })
+
+#define pic_vect2prio(v) \
+    ((((volatile unsigned char*)0xE000E400)[v]) >> (8 - MG_NVIC_PRIO_BITS))
+
+#define STIR_ADDR ((volatile unsigned int*) 0xE000EF00)
+#define pic_interrupt_request(v) ((*STIR_ADDR) = v)
+
+/* 
+ * QEMU doesn't emulate DWT, the timestamp is the elapsed count of SysTick 
+ * which runs over the full 24-bit range. It is shifted to the top 
+ * bits so that 32-bit differences stay correct across the wrap, one tick
+ * is 256 units and intervals must be shorter than 2^24 ticks.
+ */
+#define SYST_CSR_ADDR ((volatile unsigned int*) 0xE000E010)
+#define SYST_RVR_ADDR ((volatile unsigned int*) 0xE000E014)
+#define SYST_CVR_ADDR ((volatile unsigned int*) 0xE000E018)
+#define mg_port_timestamp_init() { \
+    *SYST_RVR_ADDR = 0xFFFFFFU; \
+    *SYST_CVR_ADDR = 0; \
+    *SYST_CSR_ADDR = 5;             /* enable, core clock, no interrupt */ \
+}
+#define mg_port_timestamp() ((0U - *SYST_CVR_ADDR) << 8)
+#define MG_TIMESTAMP_SHIFT 8
+
+#endif
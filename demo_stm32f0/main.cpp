@@ -49,14 +49,14 @@ static struct example_msg : public message {
     unsigned int led_state;
 } g_msgs[10];
 
-static message_pool g_pool(g_msgs);
-static queue<example_msg> g_queue;
+constinit static message_pool g_pool(g_msgs);
+constinit static queue<example_msg> g_queue;
 
-class systick_actor : public actor {
+class systick_actor : public static_actor<systick_actor> {
 public:
-    systick_actor(unsigned int vect) noexcept : actor(vect) {}
+    systick_actor(unsigned int vect) noexcept : static_actor(vect) {}
 
-    future run() override {
+    future run() {
         for(;;) {
             //auto msg = co_await poll(g_queue);
             
@@ -68,8 +68,6 @@ public:
     }
 };
 
-scheduler scheduler::context;
-timer timer::context;
 static systick_actor g_actor(EXAMPLE_VECTOR);
 
 extern "C" void WWDG_IRQHandler() {
@@ -125,15 +123,21 @@ extern "C" void hwinit() {
 }
 
 extern "C" int main() {
+    mg_port_timestamp_init();
+#if defined MG_STACK_STATS
+    scheduler::paint_stack();
+#endif
     NVIC_EnableIRQ(WWDG_IRQn);
     __enable_irq();
 
-    g_actor.run();
+    g_actor.start();
 
     SysTick->LOAD  = 48000U - 1U;
     SysTick->VAL   = 0;
     SysTick->CTRL  = 7;
 
-    for (;;);
+    for (;;) {
+        scheduler::idle();
+    }
     return 0;
 }
@@ -49,6 +49,13 @@ unsigned int mg_port_clz(uint32_t v) {
 
 #define mg_object_lock(p) { asm volatile ("cpsid i"); }
 #define mg_object_unlock(p) { asm volatile ("cpsie i"); }
+#define mg_port_sleep() { asm volatile ("wfi"); }
+
+extern "C" unsigned int _ebss[], _estack[]; // see gcc.ld
+#define mg_port_stack_limit() (_ebss)
+#define mg_port_stack_top() (_estack)
+#define mg_port_stack_pointer() \
+    ({ unsigned int* sp; asm volatile ("mov %0, sp" : "=r" (sp)); sp; })
 
 #define pic_vect2prio(v) \
     ((((volatile unsigned char*)0xE000E400)[v]) >> (8 - MG_NVIC_PRIO_BITS))
@@ -56,5 +63,30 @@ unsigned int mg_port_clz(uint32_t v) {
 #define ISPR_ADDR ((volatile unsigned int*) 0xE000E200)
 #define pic_interrupt_request(v) ((*ISPR_ADDR) = 1U << (v))
 
+/* 
+ * Cortex-M0 has no cycle counter and SysTick serves the timer tick, so the
+ * timestamp is TIM3 free-running at the core clock divided by
+ * MG_TIMESTAMP_PRESCALER, 1 us at 48 MHz by default. The 16-bit count is
+ * shifted to the top bits so that 32-bit differences stay correct across
+ * the wrap, intervals must be shorter than 2^16 counts (65 ms by default).
+ */
+#if !defined MG_TIMESTAMP_PRESCALER
+#define MG_TIMESTAMP_PRESCALER 48
+#endif
+
+#define RCC_APB1ENR_ADDR ((volatile unsigned int*) 0x4002101C)
+#define TIM3_CR1_ADDR ((volatile unsigned int*) 0x40000400)
+#define TIM3_EGR_ADDR ((volatile unsigned int*) 0x40000414)
+#define TIM3_CNT_ADDR ((volatile unsigned int*) 0x40000424)
+#define TIM3_PSC_ADDR ((volatile unsigned int*) 0x40000428)
+#define mg_port_timestamp_init() { \
+    *RCC_APB1ENR_ADDR |= 1U << 1;   /* TIM3EN */ \
+    *TIM3_PSC_ADDR = MG_TIMESTAMP_PRESCALER - 1U; \
+    *TIM3_EGR_ADDR = 1U;            /* UG, loads the prescaler */ \
+    *TIM3_CR1_ADDR = 1U;            /* CEN, wraps at 0xFFFF */ \
+}
+#define mg_port_timestamp() (*TIM3_CNT_ADDR << 16)
+#define MG_TIMESTAMP_SHIFT 16
+
 #endif
 
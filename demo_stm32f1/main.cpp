@@ -49,14 +49,14 @@ static struct example_msg : public message {
     unsigned int led_state;
 } g_msgs[10];
 
-static message_pool g_pool(g_msgs);
-static queue<example_msg> g_queue;
+constinit static message_pool g_pool(g_msgs);
+constinit static queue<example_msg> g_queue;
 
-class systick_actor : public actor {
+class systick_actor : public static_actor<systick_actor> {
 public:
-    systick_actor(unsigned int vect) noexcept : actor(vect) {}
+    systick_actor(unsigned int vect) noexcept : static_actor(vect) {}
 
-    future run() override {
+    future run() {
         for(;;) {
             auto msg = co_await poll(g_queue);
         
@@ -68,7 +68,6 @@ public:
     }
 };
 
-scheduler scheduler::context;
 static systick_actor g_actor(EXAMPLE_VECTOR);
 
 extern "C" void USB_LP_CAN1_RX0_IRQHandler() {
@@ -77,12 +76,11 @@ extern "C" void USB_LP_CAN1_RX0_IRQHandler() {
 
 extern "C" void SysTick_Handler() {
     static unsigned int led_state = 0;
-    auto allocated = g_pool.alloc();
+    auto msg = g_pool.alloc();
     
     led_state ^= 1;
 
-    if (allocated) {
-        auto& msg = *allocated;
+    if (msg) {
         msg->led_state = led_state;
         g_queue.push(msg);
     }
@@ -114,16 +112,22 @@ extern "C" void hwinit() {
 }
 
 extern "C" int main() {
+    mg_port_timestamp_init();
+#if defined MG_STACK_STATS
+    scheduler::paint_stack();
+#endif
     NVIC_SetPriorityGrouping(3);
     NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
     __enable_irq();
 
-    g_actor.run();
+    g_actor.start();
 
     SysTick->LOAD  = 72000U * 100 - 1U;
     SysTick->VAL   = 0;
     SysTick->CTRL  = 7;
 
-    for (;;);
+    for (;;) {
+        scheduler::idle();
+    }
     return 0;
 }
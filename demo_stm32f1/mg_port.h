@@ -25,6 +25,13 @@
 
 #define mg_object_lock(p) { asm volatile ("cpsid i"); }
 #define mg_object_unlock(p) { asm volatile ("cpsie i"); }
+#define mg_port_sleep() { asm volatile ("wfi"); }
+
+extern "C" unsigned int _ebss[], _estack[]; // see gcc.ld
+#define mg_port_stack_limit() (_ebss)
+#define mg_port_stack_top() (_estack)
+#define mg_port_stack_pointer() \
+    ({ unsigned int* sp; asm volatile ("mov %0, sp" : "=r" (sp)); sp; })
 
 #define pic_vect2prio(v) \
     ((((volatile unsigned char*)0xE000E400)[v]) >> (8 - MG_NVIC_PRIO_BITS))
@@ -32,5 +39,14 @@
 #define STIR_ADDR ((volatile unsigned int*) 0xE000EF00)
 #define pic_interrupt_request(v) ((*STIR_ADDR) = v)
 
+#define DEMCR_ADDR ((volatile unsigned int*) 0xE000EDFC)
+#define DWT_CTRL_ADDR ((volatile unsigned int*) 0xE0001000)
+#define DWT_CYCCNT_ADDR ((volatile unsigned int*) 0xE0001004)
+#define mg_port_timestamp_init() { \
+    *DEMCR_ADDR |= 1U << 24;        /* TRCENA */ \
+    *DWT_CTRL_ADDR |= 1U;           /* CYCCNTENA */ \
+}
+#define mg_port_timestamp() (*DWT_CYCCNT_ADDR)
+
 #endif
 
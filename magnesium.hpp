@@ -7,25 +7,40 @@
 #ifndef MAGNESIUM_HPP
 #define MAGNESIUM_HPP
 
-#include <optional>
 #include <array>
+#include <tuple>
+#include <new>
+#include <cstddef>
+#include <type_traits>
+#include <cstdint>
 #include <coroutine>
 #include "mg_port.h"
 
-namespace magnesium {
+#if defined MG_LOCKFREE_POOL || defined MG_TRACE
+#include <atomic>
+#endif
+
+#if defined MG_ACTOR_STATS || defined MG_LOAD_STATS
+#define MG_NESTED_TIME  // the scheduler tracks time of preempting loops
+#endif
 
-template<class T> using option = std::optional<T>;
+namespace magnesium {
 
 template<class T> class owner {
     T* ptr;
     void drop(T*);
         
 public:
+    constexpr owner() noexcept : ptr(nullptr) {}
+    constexpr owner(std::nullptr_t) noexcept : ptr(nullptr) {}
     owner(T* pointer) noexcept : ptr(pointer) {}
 
     owner(owner&& other) noexcept : ptr(other.ptr) {
         other.ptr = nullptr;
     }
+
+    template<class U> explicit owner(owner<U>&& other) noexcept : 
+        ptr(static_cast<T*>(other.release())) {}
     
     ~owner() {
         if (ptr != nullptr) {
@@ -43,15 +58,32 @@ public:
         return ptr; // TODO: assert ptr != nullptr
     }
 
-    owner(std::nullptr_t) = delete;
+    T& operator*() const {
+        return *ptr;
+    }
+
+    explicit operator bool() const noexcept {
+        return ptr != nullptr;
+    }
+
+    owner& operator=(owner&& other) noexcept {
+        T* const old = ptr;
+        ptr = other.release();
+
+        if (old != nullptr && old != ptr) {
+            drop(old);
+        }
+
+        return *this;
+    }
+
     owner(const owner&) = delete;
     owner& operator=(const owner& other) = delete;
-    owner& operator=(owner&& other) = delete;
 };
 
 class node {
-    node* next;
-    node* prev;
+    node* next = nullptr;
+    node* prev = nullptr;
     
 protected:
     ~node() = default;  // can't be destructed through 'delete node'
@@ -60,11 +92,17 @@ public:
     friend class list;
     friend class message;
     friend class actor;
+    friend class free_list;
+    template<class T, std::size_t N> friend class static_pool;
 
-    node() = default; // the container and its items are non-copyable/movable.
+    constexpr node() = default; // the container and its items are non-copyable/movable.
     node(const node&) = delete;
     node& operator=(const node& other) = delete;
     node& operator=(node&& other) = delete;
+
+    inline bool is_linked() const {
+        return next != nullptr;
+    }
 };
 
 class list : public node {
@@ -73,54 +111,384 @@ class list : public node {
     }
 
 public:
-    list() noexcept {
+    constexpr list() noexcept {
         this->next = this->prev = this;
     }
 
-    template<class T> inline void enqueue(owner<T>& object) {
-        node* const link = static_cast<node*>(object.release());
+    constexpr void append(node* link) {
         link->next = this;
         link->prev = this->prev;
         link->prev->next = link;
         this->prev = link;
     }
 
-    template<class T> inline option<owner<T>> dequeue() {
-        option<owner<T>> object = {};
+    inline const node* head() const {
+        return is_empty() ? nullptr : this->next;
+    }
 
-        if (!is_empty()) {
-            node* const link = this->next;
-            link->prev->next = link->next;
-            link->next->prev = link->prev;
-            link->next = link->prev = nullptr;
-            object.emplace(owner(static_cast<T*>(link)));
-        } 
+    template<class T> inline void enqueue(owner<T>& object) {
+        append(static_cast<node*>(object.release()));
+    }
+
+    template<class T> inline owner<T> dequeue() {
+        if (is_empty()) {
+            return nullptr;
+        }
 
-        return object;
+        node* const link = this->next;
+        link->prev->next = link->next;
+        link->next->prev = link->prev;
+        link->next = link->prev = nullptr;
+        return owner(static_cast<T*>(link));
     }   
 };
 
+#if defined MG_LATENCY_STATS || defined MG_LOCK_STATS
+#if !defined MG_LATENCY_BINS
+#define MG_LATENCY_BINS 16
+#endif
+
+#if !defined MG_TIMESTAMP_SHIFT
+#define MG_TIMESTAMP_SHIFT 0    // ports keeping a narrow counter in top bits
+#endif
+
+/*
+ * Log-scale histogram of delays in counter units, i.e. mg_port_timestamp()
+ * units shifted down by MG_TIMESTAMP_SHIFT. Bin 0 counts zero delays, bin i
+ * counts delays in [2^(i-1), 2^i), the last bin counts everything longer.
+ */
+struct latency_histogram {
+    unsigned int bins[MG_LATENCY_BINS];
+
+    inline void record(std::uint32_t delay) {
+        const unsigned int width = sizeof(std::uint32_t) * 8;
+        delay >>= MG_TIMESTAMP_SHIFT;
+        const unsigned int i = delay != 0 ? width - mg_port_clz(delay) : 0;
+        ++bins[i < MG_LATENCY_BINS ? i : MG_LATENCY_BINS - 1];
+    }
+};
+#endif
+
 class mutex {};
 
+enum class lock_site : std::uint8_t {
+    other,
+    activate,           // scheduler::activate() and post()
+    extract,            // taking runnables from the runqueue
+    accounting,         // optional statistics of the scheduler
+    push,               // queue push and mailbox send
+    pop,                // queue pop and mailbox receive
+    pool,               // pool alloc and statistics
+    sync,               // semaphore, event flags and interrupt
+    mutex,              // async_mutex
+    timer_subscribe,
+    timer_tick,
+    count
+};
+
+#if defined MG_LOCK_STATS
+struct lock_stats {
+    unsigned int count;
+    std::uint32_t max;          // in mg_port_timestamp() units
+    latency_histogram hold;
+    unsigned int nested;        // regions not recorded because of nesting
+};
+
+/*
+ * Hold times of critical sections per call site. Records are updated before
+ * the lock is released so they need no protection of their own. The port 
+ * lock doesn't nest: an inner unlock unmasks interrupts for the rest of the
+ * outer region, so its hold time isn't a masking window. Such regions, the
+ * inner and the outer one, are only counted as nested.
+ */
+class lock_profile {
+    static inline lock_stats sites[static_cast<unsigned int>(lock_site::count)];
+    static inline unsigned int depth = 0;
+    static inline bool broken = false;
+
+public:
+    static inline void enter() {
+        broken = broken || depth != 0;
+        ++depth;
+    }
+
+    static inline void leave(lock_site site, std::uint32_t elapsed) {
+        lock_stats& s = sites[static_cast<unsigned int>(site)];
+
+        if (--depth != 0 || broken) {
+            ++s.nested;
+            broken = depth != 0;
+            return;
+        }
+
+        ++s.count;
+        s.max = elapsed > s.max ? elapsed : s.max;
+        s.hold.record(elapsed);
+    }
+
+    static inline const lock_stats& of(lock_site site) {
+        return sites[static_cast<unsigned int>(site)];
+    }
+};
+#endif
+
 class locked_region {
     mutex& lock;
+#if defined MG_LOCK_STATS
+    const lock_site site;
+    std::uint32_t start;
+#endif
 
 public:
-    locked_region(mutex& object) noexcept : lock(object) {
+#if defined MG_LOCK_STATS
+    locked_region(mutex& object, lock_site s = lock_site::other) noexcept : 
+        lock(object), 
+        site(s) {
+        mg_object_lock(&lock);
+        lock_profile::enter();
+        start = mg_port_timestamp();
+    }
+
+   ~locked_region() {
+        lock_profile::leave(site, mg_port_timestamp() - start);
+        mg_object_unlock(&lock);
+    }
+#else
+    locked_region(mutex& object, lock_site = lock_site::other) noexcept : 
+        lock(object) {
         mg_object_lock(&lock);
     }
 
    ~locked_region() {
         mg_object_unlock(&lock);
     }
+#endif
+};
+
+#if defined MG_MESSAGE_STATS || defined MG_STATS
+struct duration_stats {
+    unsigned int count;
+    std::uint32_t max;      // in mg_port_timestamp() units
+    std::uint64_t total;
+
+    inline void record(std::uint32_t elapsed) {
+        ++count;
+        total += elapsed;
+        max = elapsed > max ? elapsed : max;
+    }
+};
+#endif
+
+#if defined MG_MESSAGE_STATS
+struct message_timing {
+    duration_stats wait;        // from push to pop
+    duration_stats service;     // from pop to the next push or drop
+    duration_stats lifetime;    // from alloc to drop, pools only
+};
+#endif
+
+struct message;
+
+class queue_base {
+protected:
+#if defined MG_LOCKFREE_POOL
+    const bool lockfree = false;    // free_list, see owner<T>::drop()
+
+    constexpr queue_base() noexcept = default;
+    constexpr explicit queue_base(bool lf) noexcept : lockfree(lf) {}
+#endif
+    inline void arrived(message& m);
+    inline void departed(message& m);
+
+#if defined MG_MESSAGE_STATS
+public:
+    message_timing timing = {};
+#endif
+    template<class T> friend class owner;
+};
+
+#if defined MG_STATS
+struct mutex_stats {
+    unsigned int locks;
+    unsigned int contended; // locks which had to wait for the holder
+    duration_stats blocked; // from contention to handoff by the holder
+    unsigned int refused;   // unlocks by an actor not holding the mutex
+};
+
+struct queue_stats {
+    unsigned int depth;     // messages currently in the queue
+    unsigned int peak;      // maximum depth ever reached
+    unsigned int pushes;
+    unsigned int waits;     // pops which had to suspend the actor
+};
+
+struct pool_stats {
+    unsigned int peak;      // maximum number of messages in use
+    unsigned int failures;  // alloc calls which returned nothing
+};
+
+#if defined MG_LOCKFREE_POOL
+struct lockfree_pool_stats {
+    std::atomic<unsigned int> peak;
+    std::atomic<unsigned int> failures;
+};
+#endif
+#endif
+
+#if defined MG_ACTOR_STATS
+struct runnable_stats {
+    unsigned int runs;      // resumptions of the actor or calls of the item
+    std::uint32_t max;      // longest single run
+    std::uint64_t total;    // all runs, in mg_port_timestamp() units
+
+    inline void record(std::uint32_t elapsed) {
+        ++runs;
+        total += elapsed;
+        max = elapsed > max ? elapsed : max;
+    }
+};
+#endif
+
+enum class trace_event : std::uint8_t {
+    activate = 1,       // id: actor, arg: its vector
+    post,               // id: work item, arg: its vector
+    schedule_enter,     // id: none, arg: vector
+    schedule_exit,      // id: none, arg: vector
+    execute,            // id: runnable, arg: vector of the loop
+    transfer,           // id: actor resumed by symmetric transfer
+    push,               // id: queue, arg: depth before push
+    pop,                // id: queue, arg: depth before pop
+    pop_wait,           // id: queue, the actor is suspended
+    tick                // id: none, arg: low byte of the tick count
+};
+
+#if defined MG_TRACE
+#if !defined MG_TRACE_LENGTH
+#define MG_TRACE_LENGTH 256
+#endif
+
+struct trace_record {
+    std::uint32_t time;     // mg_port_timestamp() units
+    std::uint16_t id;       // low 16 bits of the object address
+    std::uint8_t event;
+    std::uint8_t arg;
+};
+
+/*
+ * Ring buffer of scheduler events. Slots are reserved by an atomic 
+ * increment so records may be written from any priority without locking. 
+ * The buffer is read by a debugger (see tools/mg_trace.py), the layout is
+ * the head counter, the length and the records.
+ */
+class trace_buffer {
+    std::atomic<std::uint32_t> head;
+    const std::uint32_t length = MG_TRACE_LENGTH;
+    trace_record records[MG_TRACE_LENGTH] = {};
+
+    static_assert(
+        std::atomic<std::uint32_t>::is_always_lock_free, 
+        "MG_TRACE requires native atomics (ARMv7-M or host)"
+    );
+    static_assert(sizeof(trace_record) == 8, "trace record is 8 bytes");
+
+public:
+    static trace_buffer context;
+
+    constexpr trace_buffer() noexcept : head(0) {}
+
+    static void record(trace_event e, const void* id, unsigned int arg) {
+        const std::uint32_t time = mg_port_timestamp();
+        const std::uint32_t i = context.head.fetch_add(
+            1, 
+            std::memory_order_relaxed
+        );
+        trace_record& r = context.records[i % MG_TRACE_LENGTH];
+        r.time = time;
+        r.id = static_cast<std::uint16_t>(reinterpret_cast<std::uintptr_t>(id));
+        r.event = static_cast<std::uint8_t>(e);
+        r.arg = static_cast<std::uint8_t>(arg);
+    }
+};
+
+inline constinit trace_buffer trace_buffer::context;
+#else
+struct trace_buffer {
+    static inline void record(trace_event, const void*, unsigned int) {}
+};
+#endif
+
+#if defined MG_LOAD_STATS
+struct load_stats {
+    std::uint64_t busy[MG_PRIO_MAX];    // scheduler loops of each priority
+    std::uint64_t idle;                 // scheduler::idle() outside of loops
+    unsigned int wakeups;               // returns from mg_port_sleep()
+    std::uint32_t wakeup_max;           // longest single idle() call
 };
+#endif
 
-class queue_base {};
+#if defined MG_STACK_STATS
+struct stack_stats {
+    std::size_t entry[MG_PRIO_MAX];     // deepest stack use at loop entry
+    std::size_t peak[MG_PRIO_MAX + 1];  // deepest use of each priority, the
+                                        // last one is thread mode (main)
+};
+#endif
 
 struct message : public node {
     queue_base* parent;
+#if defined MG_MESSAGE_STATS
+    queue_base* source = nullptr;   // the queue it was popped from
+    std::uint32_t born = 0;         // alloc time, 0 while in the pool
+    std::uint32_t stamp = 0;        // time of the last push or pop
+#endif
 };
 
+/*
+ * Message timing hooks, called under the lock of the queue when a message 
+ * is pushed (or dropped back to its pool) and when it is popped (or 
+ * allocated from its pool).
+ */
+inline void queue_base::arrived(message& m) {
+#if defined MG_MESSAGE_STATS
+    const std::uint32_t now = mg_port_timestamp();
+
+    if (m.source != nullptr) {
+        m.source->timing.service.record(now - m.stamp);
+        m.source = nullptr;
+    }
+
+    if (m.parent == this) {
+        if (m.born != 0) {
+            timing.lifetime.record(now - m.born);
+        }
+
+        m.born = 0;
+    } else {
+        m.stamp = now;
+    }
+#else
+    (void)m;
+#endif
+}
+
+inline void queue_base::departed(message& m) {
+#if defined MG_MESSAGE_STATS
+    const std::uint32_t now = mg_port_timestamp();
+
+    if (m.parent == this) {
+        m.born = now != 0 ? now : 1;
+    } else {
+        timing.wait.record(now - m.stamp);
+        m.source = this;
+        m.stamp = now;
+    }
+#else
+    (void)m;
+#endif
+}
+
+template<class T> class static_actor;
+
 struct future {
     struct promise_type {
         static void* allocate(std::size_t n);        
@@ -129,29 +497,137 @@ struct future {
         std::suspend_never final_suspend() noexcept { return {}; }
         void unhandled_exception() {}
         void* operator new(std::size_t n) { return allocate(n); }
+        void operator delete(void*) noexcept {} // frames are never freed
+
+        /*
+         * Member coroutines pass the object as the first argument, so the
+         * frame size of each static_actor type is recorded on first run.
+         */
+        template<class Self> void* operator new(std::size_t n, Self&) {
+            if constexpr (std::is_base_of_v<static_actor<Self>, Self>) {
+                static_actor<Self>::frame_bytes = n;
+            }
+
+            return allocate(n);
+        }
     };
 };
 
 template<class T> class queue;
 template<class T> class message_pool;
+class semaphore;
+class event_flags;
+template<unsigned int V> class interrupt;
+class async_mutex;
+template<class T, std::size_t N> class static_pool;
+
+/*
+ * Common part of everything which may be put into the scheduler runqueue:
+ * actors resumed as coroutines and plain work items called as functions.
+ */
+class runnable : public node {
+protected:
+    ~runnable() = default;
+
+    runnable(unsigned int vect, bool work) noexcept : 
+        vect(static_cast<std::uint8_t>(vect)), 
+        prio(static_cast<std::uint8_t>(pic_vect2prio(vect))),
+        is_work(work) {}
 
-class actor : public node {
-    message* mailbox = nullptr;
-    unsigned int timeout = 0;
+public:
+    std::uint8_t vect;  // may be raised temporarily by async_mutex
+    std::uint8_t prio;
+    const bool is_work;
+#if defined MG_ACTOR_STATS
+    runnable_stats stats = {};
+#endif
+#if defined MG_LATENCY_STATS
+    std::uint32_t activated = 0;    // timestamp of the last activation
+    latency_histogram latency = {}; // from activation to run
+#endif
+
+    inline void execute();
+};
+
+enum class actor_state : std::uint8_t {
+    idle,           // not started yet
+    ready,          // activated, in the runqueue
+    running,        // resumed by the scheduler, possibly preempted
+    queue,          // waits for a message
+    mailbox,
+    semaphore,
+    event_flags,
+    irq,
+    mutex,
+    sleep           // waits for the timer
+};
+
+#if defined MG_INTROSPECTION
+struct actor_info {
+    const void* object;     // the object the actor waits for
+    unsigned int since;     // tick of the last state change
+    unsigned int last_run;  // tick of the last resumption
+    actor_state state;
+};
+#endif
+
+class actor : public runnable {
+    union {                     // actor never waits for both at once
+        message* mailbox = nullptr;
+        unsigned int timeout;
+        unsigned int events;
+#if defined MG_STATS
+        std::uint32_t blocked_since;    // waiting for async_mutex
+#endif
+    };
     std::coroutine_handle<> frame;
+#if defined MG_INTROSPECTION
+    actor* registered;
+    static inline actor* registry = nullptr;
+#endif
 
 protected:
     ~actor() = default;
 
 public:   
-    const unsigned int vect;
-    const unsigned int prio;
-    
-    virtual future run() = 0;
+#if defined MG_INTROSPECTION
+    actor_info info = {};
+
+    /*
+     * Actors are static objects constructed before main() enables
+     * interrupts, so the registry is linked without the port lock, whose
+     * unlock would enable them.
+     */
+    actor(unsigned int vect) noexcept : runnable(vect, false) {
+        registered = registry;
+        registry = this;
+    }
 
-    actor(unsigned int vect) noexcept : 
-        vect(vect), 
-        prio(pic_vect2prio(vect)) {}
+    /*
+     * Range over all constructed actors, newest first:
+     *   for (const actor& a : actor::all()) { ... }
+     */
+    struct range {
+        struct iterator {
+            actor* item;
+
+            actor& operator*() const { return *item; }
+            iterator& operator++() { item = item->registered; return *this; }
+            bool operator!=(const iterator& other) const { 
+                return item != other.item; 
+            }
+        };
+
+        iterator begin() const { return {registry}; }
+        iterator end() const { return {nullptr}; }
+    };
+
+    static inline range all() {
+        return {};
+    }
+#else
+    actor(unsigned int vect) noexcept : runnable(vect, false) {}
+#endif
 
     template<class T> inline void set_message(owner<T>& msg) {
         mailbox = msg.release();
@@ -163,198 +639,1609 @@ public:
         return owner<T>(static_cast<T*>(temp));
     }    
 
-    inline void set_handle(std::coroutine_handle<> handle) {
+    inline void set_handle(
+        std::coroutine_handle<> handle, 
+        actor_state reason, 
+        const void* object
+    ) {
         frame = handle;
+        set_state(reason, object);
     }
+
+    inline void set_state(actor_state state, const void* object = nullptr);
         
     void call() {
         frame();
     }
 
+    inline std::coroutine_handle<> handle() const {
+        return frame;
+    }
+
     template<class T> inline auto poll(queue<T>& q);
     template<class T> inline auto get(message_pool<T>& q);
+    template<class T, std::size_t N> inline auto get(static_pool<T, N>& q);
     inline auto sleep(unsigned int delay);
+    inline auto wait(semaphore& s);
+    inline auto wait(event_flags& e, unsigned int mask);
+    template<unsigned int V> inline auto irq();
+    inline auto lock(async_mutex& m);
+    inline auto unlock(async_mutex& m);
     
     friend class timer;
+    friend class event_flags;
+    friend class async_mutex;
+};
+
+#if !defined MG_ACTOR_STATS && !defined MG_LATENCY_STATS \
+    && !defined MG_INTROSPECTION
+static_assert(
+    sizeof(actor) <= 5 * sizeof(void*), 
+    "actor is expected to be 4 pointers and 3 bytes"
+);
+#endif
+
+/*
+ * Deferred function call at the priority of the given vector. It shares the
+ * runqueue with actors but needs neither a coroutine frame nor a message.
+ * Posting an item which is already pending has no effect.
+ */
+class work_item : public runnable {
+    void (*const func)(work_item&);
+
+public:
+    work_item(unsigned int vect, void (*f)(work_item&)) noexcept : 
+        runnable(vect, true), 
+        func(f) {}
+
+    inline void call() {
+        func(*this);
+    }
+
+    inline void post();
+};
+
+inline void runnable::execute() {
+    if (is_work) {
+        static_cast<work_item*>(this)->call();
+    } else {
+        static_cast<actor*>(this)->call();
+    }
+}
+
+/*
+ * Actors are static objects of known types so the coroutine is started via
+ * CRTP instead of a virtual call, actor objects have no vtable pointer.
+ * Derived class must provide 'future run()'.
+ */
+template<class T> class static_actor : public actor {
+    static inline std::size_t frame_bytes = 0;
+
+protected:
+    ~static_actor() = default;
+
+public:
+    static_actor(unsigned int vect) noexcept : actor(vect) {}
+
+    inline void start() {
+        static_assert(
+            std::is_same_v<decltype(static_cast<T*>(this)->run()), future>, 
+            "actor must define 'future run()'"
+        );
+        static_cast<T*>(this)->run();
+    }
+
+    static inline std::size_t frame_size() {
+        return frame_bytes;
+    }
+
+    friend struct future;
 };
  
+#if defined MG_SYMMETRIC_TRANSFER
+using suspend_result = std::coroutine_handle<>;
+#else
+using suspend_result = bool;
+#endif
+
 class scheduler {
     mutex lock;
     std::array<list, MG_PRIO_MAX> runqueue;
+    std::array<bool, MG_PRIO_MAX> draining = {};
+#if defined MG_SYMMETRIC_TRANSFER
+    std::array<runnable*, MG_PRIO_MAX> running = {};
+#endif
+#if defined MG_NESTED_TIME
+    std::uint32_t nested = 0;   // time spent in preempting scheduler loops
+#endif
+#if defined MG_LOAD_STATS
+    load_stats usage = {};
+#endif
+#if defined MG_ACTOR_STATS
+    std::array<std::uint32_t, MG_PRIO_MAX> run_start = {};
+    std::array<std::uint32_t, MG_PRIO_MAX> run_nested = {};
+#endif
+#if defined MG_LATENCY_STATS
+    std::array<latency_histogram, MG_PRIO_MAX> latency = {};
+#endif
+#if defined MG_STACK_STATS
+    static constexpr unsigned int stack_paint = 0xa5a5a5a5U;
+    stack_stats stack_usage = {};
+    unsigned int* stack_floor = nullptr;    // deepest word ever used
+    unsigned int stack_owner = MG_PRIO_MAX; // priority using the stack top
+#endif
     static scheduler context;
 
-    static option<owner<actor>> extract(list& runq) {
-        locked_region region(context.lock);
-        return runq.dequeue<actor>();
+    // Called under the lock when the runnable is taken from the runqueue.
+    static inline void dispatched(runnable& item, unsigned int prio) {
+#if defined MG_LATENCY_STATS
+        const std::uint32_t delay = mg_port_timestamp() - item.activated;
+        item.latency.record(delay);
+        context.latency[prio].record(delay);
+#else
+        (void)prio;
+#endif
+        if (!item.is_work) {
+            static_cast<actor&>(item).set_state(actor_state::running);
+        }
     }
 
-public:
-    static void activate(owner<actor>& target) {
-        locked_region region(context.lock);
-        pic_interrupt_request(target->vect);
-        context.runqueue[target->prio].enqueue(target);
+    static inline void activated(runnable& item) {
+#if defined MG_LATENCY_STATS
+        item.activated = mg_port_timestamp();
+#else
+        (void)item;
+#endif
     }
 
-    static void schedule(unsigned int vect) {
-        const unsigned int prio = pic_vect2prio(vect);
+    // The flag is cleared in the same critical section that observes the
+    // empty runqueue, so an activation skipping the pend can't be missed.
+    static owner<runnable> extract(unsigned int prio) {
+        locked_region region(context.lock, lock_site::extract);
+        auto item = context.runqueue[prio].dequeue<runnable>();
 
-        while (option<owner<actor>> item = extract(context.runqueue[prio])) {
-            actor* active_actor = (*item).release();
-            active_actor->call();
+        if (item) {
+            dispatched(*item, prio);
+        } else {
+            context.draining[prio] = false;
+#if defined MG_SYMMETRIC_TRANSFER
+            context.running[prio] = nullptr;
+#endif
         }
+
+        return item;
     }
-};
 
-template<class T> class queue : public queue_base {
-    list items;
-    int length = 0;
-    
-    option<owner<actor>> push_internal(owner<T>& msg) {
-        locked_region region(lock);
-        const int queue_length = length++;
+#if defined MG_ACTOR_STATS
+    /*
+     * Time since the previous lap at the priority, excluding scheduler 
+     * loops of higher priorities which preempted it meanwhile. Interrupt 
+     * handlers outside of the scheduler are not excluded.
+     */
+    static std::uint32_t lap(unsigned int prio) {
+        const std::uint32_t now = mg_port_timestamp();
+        const std::uint32_t preempted = context.nested - context.run_nested[prio];
+        const std::uint32_t elapsed = now - context.run_start[prio] - preempted;
+        context.run_start[prio] = now;
+        context.run_nested[prio] = context.nested;
+        return elapsed;
+    }
+#endif
 
-        if (queue_length >= 0) {
-            items.enqueue(msg);
-        } else {
-            option<owner<actor>> item = items.dequeue<actor>();
-            owner<actor>& subscriber = *item;
-            subscriber->set_message(msg);
-            return item;
+#if defined MG_STACK_STATS
+    /*
+     * Credits the stack used below the stack pointer since the last check to
+     * the priority and repaints it, so the next check sees only new usage.
+     * Used words are expected to be contiguous, the scan starts from the 
+     * deepest word ever used. Must be called with interrupts locked.
+     */
+    static void stack_check(unsigned int prio) {
+        unsigned int* const sp = mg_port_stack_pointer();
+        unsigned int* const limit = mg_port_stack_limit();
+        unsigned int* const start = 
+            context.stack_floor < sp ? context.stack_floor : sp;
+        unsigned int* deepest = start;
+
+        while (deepest > limit && deepest[-1] != stack_paint) {
+            --deepest;
         }
-        
-        return std::nullopt;
-    }
-    
-    option<owner<T>> pop_internal(actor& subscriber, std::coroutine_handle<> h) {
-        locked_region region(lock);
-        const int queue_length = length--;
 
-        if (queue_length <= 0) {
-            subscriber.set_handle(h);
-            auto subscr_owner = owner(&subscriber);
-            items.enqueue(subscr_owner);
+        if (deepest == start) {
+            while (deepest < sp && *deepest == stack_paint) {
+                ++deepest;
+            }
         } else {
-            return items.dequeue<T>();
+            context.stack_floor = deepest;
         }
 
-        return std::nullopt;
-    }
-
-protected:
-    mutex lock;
+        const std::size_t depth = static_cast<std::size_t>(
+            reinterpret_cast<unsigned char*>(mg_port_stack_top()) - 
+            reinterpret_cast<unsigned char*>(deepest)
+        );
+        std::size_t& peak = context.stack_usage.peak[prio];
+        peak = depth > peak ? depth : peak;
 
-    option<owner<T>> try_pop() {
-        locked_region region(lock);
+        for (unsigned int* p = deepest; p < sp; ++p) {
+            *p = stack_paint;
+        }
+    }
 
-        if (length > 0) {
-            --length;
-            return items.dequeue<T>();
-        } 
-        
-        return std::nullopt;
+    /*
+     * The stack pointer at which the preempted priority was interrupted is
+     * not known, so the exception frame and the frames of this handler down
+     * to here are credited to the preempted priority (to main() for the
+     * first interrupt), as are their remains found by its next check.
+     */
+    static unsigned int stack_enter(unsigned int prio) {
+        locked_region region(context.lock, lock_site::accounting);
+        stack_check(context.stack_owner);
+
+        const std::size_t depth = static_cast<std::size_t>(
+            reinterpret_cast<unsigned char*>(mg_port_stack_top()) - 
+            reinterpret_cast<unsigned char*>(mg_port_stack_pointer())
+        );
+        std::size_t& entry = context.stack_usage.entry[prio];
+        entry = depth > entry ? depth : entry;
+
+        const unsigned int preempted = context.stack_owner;
+        context.stack_owner = prio;
+        return preempted;
     }
 
-    auto pop(actor& subscriber) {
-        struct awaitable {
-            actor& subscriber;
-            queue<T>& source;
-            
-            awaitable(queue<T>& q, actor& a) noexcept : 
-                subscriber(a), 
-                source(q) {}
-            
-            bool await_ready() const noexcept { 
-                option<owner<T>> msg = source.try_pop();
-                
-                if (msg) {
-                    subscriber.set_message(*msg);
-                }
-                
-                return (bool)msg;
-            }
-            
-            bool await_suspend(std::coroutine_handle<> h) const noexcept {
-                option<owner<T>> msg = source.pop_internal(subscriber, h);
-                
-                if (msg) {
-                    subscriber.set_message(*msg);
-                }
+    static void stack_exit(unsigned int prio, unsigned int preempted) {
+        locked_region region(context.lock, lock_site::accounting);
+        stack_check(prio);
+        context.stack_owner = preempted;
+    }
+#endif
 
-                return !(bool)msg;
-            }
-            
-            owner<T> await_resume() const noexcept {
-                return subscriber.take_message<T>();
-            }
-        };
-        
-        return awaitable(*this, subscriber);
+    // No interrupt request is needed when the drain loop of the priority is
+    // already running, it picks up the new item before returning.
+    static void request(unsigned int vect, unsigned int prio) {
+        if (!context.draining[prio]) {
+            pic_interrupt_request(vect);
+        }
     }
-    
+
 public:
-    inline void push(owner<T>& msg) {
-        option<owner<actor>> subscriber = push_internal(msg);
+    static void activate(owner<actor>& target) {
+        locked_region region(context.lock, lock_site::activate);
+        trace_buffer::record(trace_event::activate, &*target, target->vect);
+        activated(*target);
+        target->set_state(actor_state::ready);
+        request(target->vect, target->prio);
+        context.runqueue[target->prio].enqueue(target);
+    }
+
+    static void post(work_item& item) {
+        locked_region region(context.lock, lock_site::activate);
+
+        if (!item.is_linked()) {
+            auto item_owner = owner(&item);
+            trace_buffer::record(trace_event::post, &item, item.vect);
+            activated(item);
+            request(item.vect, item.prio);
+            context.runqueue[item.prio].enqueue(item_owner);
+        }
+    }
+
+#if defined MG_LOAD_STATS
+    static const load_stats& load() {
+        return context.usage;
+    }
+#endif
+
+    /*
+     * Background loop body, main() calls it forever after starting actors.
+     * With MG_IDLE_SLEEP the core sleeps in mg_port_sleep() until the next
+     * interrupt. With MG_LOAD_STATS the time of the call which was not 
+     * spent in scheduler loops is accounted as idle. When the timestamp 
+     * counter stops in sleep (DWT CYCCNT does) it is the cost of waking up
+     * plus handlers outside of the scheduler.
+     */
+    static void idle() {
+#if defined MG_LOAD_STATS
+        const std::uint32_t start = mg_port_timestamp();
+        const std::uint32_t nested = context.nested;
+#endif
+#if defined MG_IDLE_SLEEP
+        mg_port_sleep();
+#endif
+#if defined MG_LOAD_STATS
+        locked_region region(context.lock, lock_site::accounting);
+        const std::uint32_t elapsed = 
+            mg_port_timestamp() - start - (context.nested - nested);
+        load_stats& usage = context.usage;
+        usage.idle += elapsed;
+        usage.wakeup_max = 
+            elapsed > usage.wakeup_max ? elapsed : usage.wakeup_max;
+#if defined MG_IDLE_SLEEP
+        ++usage.wakeups;
+#endif
+#endif
+    }
+
+#if defined MG_STACK_STATS
+    /*
+     * Fills the unused stack with a pattern, must be called in main() 
+     * before interrupts are enabled.
+     */
+    static void paint_stack() {
+        unsigned int* const sp = mg_port_stack_pointer();
+
+        for (unsigned int* p = mg_port_stack_limit(); p < sp; ++p) {
+            *p = stack_paint;
+        }
+
+        context.stack_floor = sp;
+    }
+
+    static const stack_stats& stack() {
+        locked_region region(context.lock, lock_site::accounting);
+        stack_check(context.stack_owner);
+        return context.stack_usage;
+    }
+#endif
+
+#if defined MG_LATENCY_STATS
+    static const latency_histogram& prio_latency(unsigned int prio) {
+        return context.latency[prio];
+    }
+#endif
+
+    static void schedule(unsigned int vect) {
+        const unsigned int prio = pic_vect2prio(vect);
+        context.draining[prio] = true;
+        trace_buffer::record(trace_event::schedule_enter, nullptr, vect);
+#if defined MG_STACK_STATS
+        const unsigned int preempted = stack_enter(prio);
+#endif
+#if defined MG_NESTED_TIME
+        const std::uint32_t loop_start = mg_port_timestamp();
+        const std::uint32_t loop_nested = context.nested;
+#endif
+
+        while (owner<runnable> item = extract(prio)) {
+            runnable* const active = item.release();
+#if defined MG_SYMMETRIC_TRANSFER
+            context.running[prio] = active;
+#endif
+            trace_buffer::record(trace_event::execute, active, vect);
+#if defined MG_ACTOR_STATS
+            lap(prio);
+            active->execute();
+            locked_region region(context.lock, lock_site::accounting);
+#if defined MG_SYMMETRIC_TRANSFER
+            context.running[prio]->stats.record(lap(prio));
+#else
+            active->stats.record(lap(prio));
+#endif
+#else
+            active->execute();
+#endif
+        }
+
+#if defined MG_NESTED_TIME
+        {
+            // Nested loops already added themselves, so the net time of 
+            // this loop is added by setting the sum including it.
+            locked_region region(context.lock, lock_site::accounting);
+            const std::uint32_t elapsed = mg_port_timestamp() - loop_start;
+#if defined MG_LOAD_STATS
+            context.usage.busy[prio] += elapsed - (context.nested - loop_nested);
+#endif
+            context.nested = loop_nested + elapsed;
+        }
+#endif
+#if defined MG_STACK_STATS
+        stack_exit(prio, preempted);
+#endif
+        trace_buffer::record(trace_event::schedule_exit, nullptr, vect);
+    }
+
+    /*
+     * Result of await_suspend. With MG_SYMMETRIC_TRANSFER an actor which 
+     * suspends within the drain loop of its priority resumes the next actor 
+     * of the runqueue directly, so a chain of same-priority hops neither 
+     * returns to schedule() nor grows the stack. Work items and actors 
+     * started outside of the loop fall back to the loop/caller. The actor 
+     * may already be resumed elsewhere when this is called, so only its 
+     * address and priority captured before suspending are used.
+     */
+    static suspend_result transfer(
+        const actor* self, 
+        unsigned int prio, 
+        bool suspended, 
+        std::coroutine_handle<> h
+    ) {
+#if defined MG_SYMMETRIC_TRANSFER
+        if (!suspended) {
+            return h;
+        }
+
+        locked_region region(context.lock, lock_site::extract);
+        list& runq = context.runqueue[prio];
+        const auto* next = static_cast<const runnable*>(runq.head());
+
+        if (context.running[prio] != self || !next || next->is_work) {
+            return std::noop_coroutine();
+        }
+
+        actor* const target = runq.dequeue<actor>().release();
+        dispatched(*target, prio);
+#if defined MG_ACTOR_STATS
+        context.running[prio]->stats.record(lap(prio));
+#endif
+        context.running[prio] = target;
+        trace_buffer::record(trace_event::transfer, target, target->vect);
+        return target->handle();
+#else
+        (void)self;
+        (void)prio;
+        (void)h;
+        return suspended;
+#endif
+    }
+};
+
+inline constinit scheduler scheduler::context;
+
+/*
+ * Actor with built-in mailbox for the common single-consumer case. Messages
+ * are sent directly to the actor, no separate queue is needed. The inbox 
+ * contains either pending messages or the actor itself when it waits for
+ * mail, in the latter case the message is handed to it and it is activated.
+ */
+template<class T, class M> class mailbox_actor : public static_actor<T> {
+    list inbox;
+    [[no_unique_address]] mutex lock;
+
+    bool try_receive() {
+        locked_region region(lock, lock_site::pop);
+        owner<message> msg = inbox.dequeue<message>();
+
+        if (msg) {
+            this->set_message(msg);
+            return true;
+        }
+
+        return false;
+    }
+
+    bool receive_or_wait(std::coroutine_handle<> h) {
+        locked_region region(lock, lock_site::pop);
+        owner<message> msg = inbox.dequeue<message>();
+
+        if (msg) {
+            this->set_message(msg);
+            return false;
+        }
+
+        auto self = owner<actor>(this);
+        this->set_handle(h, actor_state::mailbox, this);
+        inbox.enqueue(self);
+        return true;
+    }
+
+protected:
+    ~mailbox_actor() = default;
+
+    auto receive() {
+        struct awaitable {
+            mailbox_actor& self;
+
+            awaitable(mailbox_actor& a) noexcept : self(a) {}
+
+            bool await_ready() const noexcept {
+                return self.try_receive();
+            }
+
+            suspend_result await_suspend(
+                std::coroutine_handle<> h
+            ) const noexcept {
+                mailbox_actor& a = self;
+                const unsigned int prio = a.prio;
+                return scheduler::transfer(&a, prio, a.receive_or_wait(h), h);
+            }
+
+            owner<M> await_resume() const noexcept {
+                return self.template take_message<M>();
+            }
+        };
+
+        return awaitable(*this);
+    }
+
+public:
+    mailbox_actor(unsigned int vect) noexcept : static_actor<T>(vect) {}
+
+    void send(owner<M>& msg) {
+        owner<actor> self = nullptr;
+        {
+            locked_region region(lock, lock_site::push);
+
+            if (inbox.head() == static_cast<actor*>(this)) {
+                self = inbox.dequeue<actor>();
+                self->set_message(msg);
+            } else {
+                inbox.enqueue(msg);
+            }
+        }
+
+        if (self) {
+            scheduler::activate(self);
+        }
+    }
+};
+
+class message_queue : public queue_base {
+    list items;
+    int length = 0;
+    
+    inline void update_depth() {
+#if defined MG_STATS
+        stats.depth = count();
+        stats.peak = stats.depth > stats.peak ? stats.depth : stats.peak;
+#endif
+    }
+
+    owner<actor> push_internal(owner<message>& msg) {
+        locked_region region(lock, lock_site::push);
+        const int queue_length = length++;
+        const int depth = queue_length > 0 ? queue_length : 0;
+        trace_buffer::record(trace_event::push, this, depth);
+        arrived(*msg);
+#if defined MG_STATS
+        ++stats.pushes;
+#endif
+        if (queue_length >= 0) {
+            items.enqueue(msg);
+            update_depth();
+        } else {
+            owner<actor> subscriber = items.dequeue<actor>();
+            departed(*msg);
+            subscriber->set_message(msg);
+            return subscriber;
+        }
+        
+        return nullptr;
+    }
+
+protected:
+    mutex lock;
+
+    inline std::size_t count() const {
+        return length > 0 ? static_cast<std::size_t>(length) : 0;
+    }
+
+    constexpr void prefill(message& item) {
+        item.parent = this;
+        items.append(&item);
+        ++length;
+    }
+
+    owner<message> pop_internal(
+        actor& subscriber, 
+        std::coroutine_handle<> h
+    ) {
+        locked_region region(lock, lock_site::pop);
+        const int queue_length = length--;
+
+        if (queue_length <= 0) {
+            trace_buffer::record(trace_event::pop_wait, this, 0);
+            subscriber.set_handle(h, actor_state::queue, this);
+            auto subscr_owner = owner(&subscriber);
+            items.enqueue(subscr_owner);
+#if defined MG_STATS
+            ++stats.waits;
+#endif
+        } else {
+            trace_buffer::record(trace_event::pop, this, queue_length);
+            update_depth();
+            owner<message> msg = items.dequeue<message>();
+            departed(*msg);
+            return msg;
+        }
+
+        return nullptr;
+    }
+
+    owner<message> try_pop() {
+        locked_region region(lock, lock_site::pop);
+        return try_pop_locked();
+    }
+
+    // The caller holds the lock.
+    owner<message> try_pop_locked() {
+        if (length > 0) {
+            trace_buffer::record(trace_event::pop, this, length);
+            --length;
+            update_depth();
+            owner<message> msg = items.dequeue<message>();
+            departed(*msg);
+            return msg;
+        } 
+        
+        return nullptr;
+    }
+
+public:
+#if defined MG_STATS
+    queue_stats stats = {};
+#endif
+
+    inline void push(owner<message>& msg) {
+        owner<actor> subscriber = push_internal(msg);
         
         if (subscriber) {
-            scheduler::activate(*subscriber);
+            scheduler::activate(subscriber);
+        }
+    }
+};
+
+/*
+ * Typed facade over message_queue. All the list manipulation is done by
+ * the non-template base so the code is shared across message types and
+ * messages may be returned to their parent without knowing its type.
+ */
+template<class T> class queue : public message_queue {
+protected:
+    owner<T> try_pop() {
+        return owner<T>(message_queue::try_pop());
+    }
+
+    auto pop(actor& subscriber) {
+        struct awaitable {
+            actor& subscriber;
+            queue<T>& source;
+            
+            awaitable(queue<T>& q, actor& a) noexcept : 
+                subscriber(a), 
+                source(q) {}
+            
+            bool await_ready() const noexcept { 
+                owner<message> msg = source.message_queue::try_pop();
+                
+                if (msg) {
+                    subscriber.set_message(msg);
+                    return true;
+                }
+                
+                return false;
+            }
+            
+            suspend_result await_suspend(
+                std::coroutine_handle<> h
+            ) const noexcept {
+                actor& a = subscriber;
+                const unsigned int prio = a.prio;
+                owner<message> msg = source.pop_internal(a, h);
+                const bool suspended = !msg;
+                
+                if (msg) {
+                    a.set_message(msg);
+                }
+
+                return scheduler::transfer(&a, prio, suspended, h);
+            }
+            
+            owner<T> await_resume() const noexcept {
+                return subscriber.take_message<T>();
+            }
+        };
+        
+        return awaitable(*this, subscriber);
+    }
+    
+public:
+    inline void push(owner<T>& msg) {
+        owner<message> item(std::move(msg));
+        message_queue::push(item);
+    }
+    
+    friend class actor;
+};
+
+/*
+ * Counting semaphore. Signal may be called from interrupt handlers, the
+ * count is handed directly to the first waiting actor if any.
+ */
+class semaphore {
+    mutex lock;
+    list waiters;
+    int count;  // negative value is the number of waiting actors
+
+    bool try_take() {
+        locked_region region(lock, lock_site::sync);
+
+        if (count > 0) {
+            --count;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool take_or_wait(actor& subscriber, std::coroutine_handle<> h) {
+        locked_region region(lock, lock_site::sync);
+        const int old_count = count--;
+
+        if (old_count <= 0) {
+            subscriber.set_handle(h, actor_state::semaphore, this);
+            auto subscr_owner = owner(&subscriber);
+            waiters.enqueue(subscr_owner);
+            return true;
+        }
+
+        return false;
+    }
+
+protected:
+    auto wait(actor& subscriber) {
+        struct awaitable {
+            actor& subscriber;
+            semaphore& source;
+
+            awaitable(semaphore& s, actor& a) noexcept : 
+                subscriber(a), 
+                source(s) {}
+
+            bool await_ready() const noexcept {
+                return source.try_take();
+            }
+
+            suspend_result await_suspend(
+                std::coroutine_handle<> h
+            ) const noexcept {
+                actor& a = subscriber;
+                const unsigned int prio = a.prio;
+                const bool suspended = source.take_or_wait(a, h);
+                return scheduler::transfer(&a, prio, suspended, h);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        return awaitable(*this, subscriber);
+    }
+
+public:
+    constexpr semaphore(int initial = 0) noexcept : count(initial) {}
+
+    void signal() {
+        owner<actor> subscriber = nullptr;
+        {
+            locked_region region(lock, lock_site::sync);
+
+            if (count++ < 0) {
+                subscriber = waiters.dequeue<actor>();
+            }
+        }
+
+        if (subscriber) {
+            scheduler::activate(subscriber);
+        }
+    }
+
+    friend class actor;
+};
+
+/*
+ * Set of event bits. An actor waits for any bit of the given mask, the 
+ * matching bits are cleared and returned as the value of co_await. Set may
+ * be called from interrupt handlers.
+ */
+class event_flags {
+    mutex lock;
+    list waiters;
+    unsigned int waiting = 0;
+    unsigned int flags;
+
+    unsigned int try_consume(unsigned int mask) {
+        locked_region region(lock, lock_site::sync);
+        const unsigned int matched = flags & mask;
+        flags &= ~matched;
+        return matched;
+    }
+
+    bool consume_or_wait(
+        actor& subscriber, 
+        unsigned int mask, 
+        std::coroutine_handle<> h
+    ) {
+        locked_region region(lock, lock_site::sync);
+        const unsigned int matched = flags & mask;
+
+        if (matched != 0) {
+            flags &= ~matched;
+            subscriber.events = matched;
+            return false;
+        }
+
+        subscriber.events = mask;
+        subscriber.set_handle(h, actor_state::event_flags, this);
+        auto subscr_owner = owner(&subscriber);
+        waiters.enqueue(subscr_owner);
+        ++waiting;
+        return true;
+    }
+
+protected:
+    auto wait(actor& subscriber, unsigned int mask) {
+        struct awaitable {
+            actor& subscriber;
+            event_flags& source;
+            const unsigned int mask;
+
+            awaitable(event_flags& e, actor& a, unsigned int m) noexcept : 
+                subscriber(a), 
+                source(e),
+                mask(m) {}
+
+            bool await_ready() const noexcept {
+                const unsigned int matched = source.try_consume(mask);
+                subscriber.events = matched;
+                return matched != 0;
+            }
+
+            suspend_result await_suspend(
+                std::coroutine_handle<> h
+            ) const noexcept {
+                actor& a = subscriber;
+                const unsigned int prio = a.prio;
+                const bool suspended = source.consume_or_wait(a, mask, h);
+                return scheduler::transfer(&a, prio, suspended, h);
+            }
+
+            unsigned int await_resume() const noexcept {
+                return subscriber.events;
+            }
+        };
+
+        return awaitable(*this, subscriber, mask);
+    }
+
+public:
+    constexpr event_flags(unsigned int initial = 0) noexcept : 
+        flags(initial) {}
+
+    /*
+     * Waiters are visited in FIFO order, the ones not matched are requeued
+     * so the order is kept. Matched ones are collected and activated after
+     * the lock is released since the lock doesn't nest.
+     */
+    void set(unsigned int bits) {
+        list woken;
+        {
+            locked_region region(lock, lock_site::sync);
+            const unsigned int len = waiting;
+
+            flags |= bits;
+
+            for (unsigned int i = 0; i < len; ++i) {
+                owner<actor> item = waiters.dequeue<actor>();
+                const unsigned int matched = flags & item->events;
+
+                if (matched != 0) {
+                    flags &= ~matched;
+                    item->events = matched;
+                    --waiting;
+                    woken.enqueue(item);
+                } else {
+                    waiters.enqueue(item);
+                }
+            }
+        }
+
+        while (owner<actor> item = woken.dequeue<actor>()) {
+            scheduler::activate(item);
+        }
+    }
+
+    void clear(unsigned int bits) {
+        locked_region region(lock, lock_site::sync);
+        flags &= ~bits;
+    }
+
+    friend class actor;
+};
+
+/*
+ * Hardware interrupt as an event. An actor parks itself on the vector and 
+ * the handler of that vector just calls notify(). No message, pool or queue
+ * is involved. Only one actor may wait for a given vector. Notification
+ * which comes when nobody waits is remembered (but not counted).
+ */
+template<unsigned int V> class interrupt {
+    static inline mutex lock;
+    static inline actor* waiter = nullptr;
+    static inline bool pending = false;
+
+    static bool park(actor& subscriber, std::coroutine_handle<> h) {
+        locked_region region(lock, lock_site::sync);
+
+        if (pending) {
+            pending = false;
+            return false;
+        }
+
+        subscriber.set_handle(h, actor_state::irq, &waiter);
+        waiter = &subscriber;
+        return true;
+    }
+
+public:
+    static void notify() {
+        owner<actor> subscriber = nullptr;
+        {
+            locked_region region(lock, lock_site::sync);
+
+            if (waiter != nullptr) {
+                subscriber = owner(waiter);
+                waiter = nullptr;
+            } else {
+                pending = true;
+            }
+        }
+
+        if (subscriber) {
+            scheduler::activate(subscriber);
+        }
+    }
+
+    static auto wait(actor& subscriber) {
+        struct awaitable {
+            actor& subscriber;
+
+            awaitable(actor& a) noexcept : subscriber(a) {}
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            suspend_result await_suspend(
+                std::coroutine_handle<> h
+            ) const noexcept {
+                actor& a = subscriber;
+                const unsigned int prio = a.prio;
+                const bool suspended = interrupt<V>::park(a, h);
+                return scheduler::transfer(&a, prio, suspended, h);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        return awaitable(subscriber);
+    }
+};
+
+/*
+ * Mutex for resources shared by actors of different priorities. It uses the
+ * immediate priority ceiling protocol: the holder is moved to the ceiling
+ * vector (usually the vector of the most urgent user) for the duration of 
+ * the lock, so no other user may preempt it and blocking of the most urgent
+ * actor is bounded by the longest critical section of others. Since actors
+ * run in interrupt handlers the priority is raised by migration: the actor
+ * suspends and resumes in the handler of the ceiling vector. Lock and unlock
+ * are awaitable. The holder may suspend while holding the lock, other users
+ * wait then.
+ */
+class async_mutex {
+    mutex lock;
+    list waiters;
+    actor* holder = nullptr;
+    const std::uint8_t ceiling_vect;
+    std::uint8_t home_vect = 0;
+    std::uint8_t home_prio = 0;
+
+    bool raise(actor& subscriber) {
+        holder = &subscriber;
+        home_vect = subscriber.vect;
+        home_prio = subscriber.prio;
+        const unsigned int ceiling_prio = pic_vect2prio(ceiling_vect);
+
+        if (subscriber.prio > ceiling_prio) {
+            subscriber.vect = ceiling_vect;
+            subscriber.prio = static_cast<std::uint8_t>(ceiling_prio);
+            return true;
         }
+
+        return false;
     }
-    
+
+    bool acquire(actor& subscriber, std::coroutine_handle<> h) {
+        bool migrate = false;
+        {
+            locked_region region(lock, lock_site::mutex);
+            subscriber.set_handle(h, actor_state::mutex, this);
+#if defined MG_STATS
+            ++stats.locks;
+#endif
+            if (holder != nullptr) {
+#if defined MG_STATS
+                ++stats.contended;
+                subscriber.blocked_since = mg_port_timestamp();
+#endif
+                auto subscr_owner = owner(&subscriber);
+                waiters.enqueue(subscr_owner);
+                return true;
+            }
+
+            migrate = raise(subscriber);
+        }
+
+        if (migrate) {
+            auto subscr_owner = owner(&subscriber);
+            scheduler::activate(subscr_owner);
+        }
+
+        return migrate;
+    }
+
+    bool release(actor& subscriber, std::coroutine_handle<> h) {
+        owner<actor> next = nullptr;
+        bool migrate = false;
+        {
+            locked_region region(lock, lock_site::mutex);
+
+            if (holder != &subscriber) {
+#if defined MG_STATS
+                ++stats.refused;
+#endif
+                return false;
+            }
+
+            migrate = (subscriber.prio != home_prio);
+            subscriber.vect = home_vect;
+            subscriber.prio = home_prio;
+            holder = nullptr;
+            next = waiters.dequeue<actor>();
+
+            if (next) {
+#if defined MG_STATS
+                stats.blocked.record(mg_port_timestamp() - next->blocked_since);
+#endif
+                raise(*next);
+            }
+        }
+
+        if (next) {
+            scheduler::activate(next);
+        }
+
+        if (migrate) {
+            auto subscr_owner = owner(&subscriber);
+            subscriber.set_handle(h, actor_state::mutex, this);
+            scheduler::activate(subscr_owner);
+        }
+
+        return migrate;
+    }
+
+protected:
+    auto acquire(actor& subscriber) {
+        struct awaitable {
+            actor& subscriber;
+            async_mutex& source;
+
+            awaitable(async_mutex& m, actor& a) noexcept : 
+                subscriber(a), 
+                source(m) {}
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            suspend_result await_suspend(
+                std::coroutine_handle<> h
+            ) const noexcept {
+                actor& a = subscriber;
+                const unsigned int prio = a.prio;
+                const bool suspended = source.acquire(a, h);
+                return scheduler::transfer(&a, prio, suspended, h);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        return awaitable(*this, subscriber);
+    }
+
+    auto release(actor& subscriber) {
+        struct awaitable {
+            actor& subscriber;
+            async_mutex& source;
+
+            awaitable(async_mutex& m, actor& a) noexcept : 
+                subscriber(a), 
+                source(m) {}
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            suspend_result await_suspend(
+                std::coroutine_handle<> h
+            ) const noexcept {
+                actor& a = subscriber;
+                const unsigned int prio = a.prio;
+                const bool suspended = source.release(a, h);
+                return scheduler::transfer(&a, prio, suspended, h);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        return awaitable(*this, subscriber);
+    }
+
+public:
+#if defined MG_STATS
+    mutex_stats stats = {};
+#endif
+
+    // The ceiling priority is read when the lock is taken, so a constinit
+    // mutex doesn't depend on the interrupt controller setup.
+    constexpr async_mutex(unsigned int ceiling) noexcept : 
+        ceiling_vect(static_cast<std::uint8_t>(ceiling)) {}
+
     friend class actor;
 };
 
+#if defined MG_LOCKFREE_POOL
+
+/*
+ * Lock-free stack of free messages for pools used from interrupt handlers.
+ * The head is a 16-bit index of the topmost item paired with a 16-bit 
+ * modification tag, so a CAS based on a stale head fails even if the same
+ * item is on top again after intermediate alloc/free (ABA). Free items are 
+ * linked through their node::next fields. Items are never returned to the 
+ * system so reading the link of an item which has been allocated meanwhile 
+ * is harmless: the following CAS rejects it. Array items which were never
+ * allocated are handed out by a CAS on the 'fresh' index when the stack is
+ * empty, so the constructor doesn't touch the array and a constinit pool
+ * is emitted into .data.
+ */
+class free_list : public queue_base {
+    static constexpr std::uint32_t nil = 0xffffU;
+    std::atomic<std::uint32_t> head;
+    std::atomic<unsigned int> fresh;
+    std::atomic<unsigned int> used;
+    message* const items;
+    const std::size_t stride;
+    const unsigned int capacity;
+
+    static_assert(
+        std::atomic<std::uint32_t>::is_always_lock_free, 
+        "MG_LOCKFREE_POOL requires native CAS (ARMv7-M or host)"
+    );
+
+    inline message* at(std::uint32_t index) const {
+        auto* const base = reinterpret_cast<unsigned char*>(items);
+        return reinterpret_cast<message*>(base + index * stride);
+    }
+
+    inline std::uint32_t index_of(const node* link) const {
+        if (link == nullptr) {
+            return nil;
+        }
+
+        const auto* m = reinterpret_cast<const unsigned char*>(
+            static_cast<const message*>(link)
+        );
+        const auto* base = reinterpret_cast<const unsigned char*>(items);
+
+        return static_cast<std::uint32_t>((m - base) / stride);
+    }
+
+    static inline std::uint32_t tagged(std::uint32_t old, std::uint32_t i) {
+        return ((old + 0x10000U) & 0xffff0000U) | i;
+    }
+
+    message* pop_free() {
+        std::uint32_t old = head.load(std::memory_order_acquire);
+        message* m;
+
+        do {
+            const std::uint32_t i = old & 0xffffU;
+
+            if (i == nil) {
+                return nullptr;
+            }
+
+            m = at(i);
+        } while (!head.compare_exchange_weak(
+            old, 
+            tagged(old, index_of(m->next)), 
+            std::memory_order_acq_rel,
+            std::memory_order_acquire
+        ));
+
+        return m;
+    }
+
+    message* take_fresh() {
+        unsigned int i = fresh.load(std::memory_order_relaxed);
+
+        do {
+            if (i >= capacity) {
+                return nullptr;
+            }
+        } while (!fresh.compare_exchange_weak(
+            i, 
+            i + 1, 
+            std::memory_order_relaxed
+        ));
+
+        message* const m = at(i);
+        m->parent = this;
+        m->prev = nullptr;
+        return m;
+    }
+
+protected:
+    constexpr free_list(message* first, std::size_t size, std::size_t n) 
+        noexcept :
+        queue_base(true),
+        head(nil),
+        fresh(0),
+        used(0),
+        items(first),
+        stride(size),
+        capacity(static_cast<unsigned int>(n))
+#if defined MG_STATS
+        , alloc_stats{ {0}, {0} }
+#endif
+        {}
+
+    message* try_alloc() {
+        message* m = pop_free();
+
+        if (m == nullptr) {
+            m = take_fresh();
+        }
+
+        if (m == nullptr) {
+#if defined MG_STATS
+            alloc_stats.failures.fetch_add(1, std::memory_order_relaxed);
+#endif
+            return nullptr;
+        }
+
+#if defined MG_STATS
+        const unsigned int n = used.fetch_add(1, std::memory_order_relaxed) + 1;
+        unsigned int peak = alloc_stats.peak.load(std::memory_order_relaxed);
+
+        while (n > peak && !alloc_stats.peak.compare_exchange_weak(
+            peak, 
+            n, 
+            std::memory_order_relaxed
+        )) {}
+#else
+        used.fetch_add(1, std::memory_order_relaxed);
+#endif
+        m->next = nullptr;
+        return m;
+    }
+
+public:
+#if defined MG_STATS
+    lockfree_pool_stats alloc_stats;
+#endif
+
+    inline std::size_t available() const {
+        return capacity - used.load(std::memory_order_relaxed);
+    }
+
+    void free(message* m) {
+        const std::uint32_t i = index_of(m);
+#if defined MG_MESSAGE_STATS
+        m->source = nullptr;    // service and lifetime need a lock, not kept
+#endif
+        std::uint32_t old = head.load(std::memory_order_relaxed);
+
+        do {
+            const std::uint32_t top = old & 0xffffU;
+            m->next = (top != nil) ? at(top) : nullptr;
+        } while (!head.compare_exchange_weak(
+            old, 
+            tagged(old, i), 
+            std::memory_order_release,
+            std::memory_order_relaxed
+        ));
+        used.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+/*
+ * Pool over an array like message_pool, for messages allocated mostly in 
+ * interrupt handlers. Alloc and drop never disable interrupts, actors can't
+ * wait for a free message. It may be used next to locked pools.
+ */
+template<class T> class lockfree_pool : public free_list {
+public:
+    template<unsigned int N> constexpr lockfree_pool(T (&arr)[N]) noexcept :
+        free_list(&arr[0], sizeof(T), N) {
+        static_assert(N < 0xffffU, "too many items for 16-bit index");
+    }
+
+    owner<T> alloc() {
+        return owner(static_cast<T*>(this->try_alloc()));
+    }
+};
+
+#endif
+
 template<class T> class message_pool : public queue<T> {
     T* const items_array;
     const std::size_t array_length;
     std::size_t offset;
 
-    inline option<owner<T>> try_pick_from_array() {
-        locked_region region(this->lock);
+    inline std::size_t free_items() const {
+        return (array_length - offset) + this->count();
+    }
 
+    // The caller holds the lock.
+    inline owner<T> pick_from_array() {
         if (offset < array_length) {
             T& item = items_array[offset++];
             item.parent = this;
             return owner(&item);
         }
         
-        return std::nullopt;
+        return nullptr;
+    }
+
+    inline owner<T> try_pick_from_array() {
+        locked_region region(this->lock, lock_site::pool);
+        return pick_from_array();
     }
 
 protected:
     auto get(actor& subscriber) {
-        option<owner<T>> msg = try_pick_from_array();
+        owner<T> msg = try_pick_from_array();
         
         if (msg) {
-            this->push(*msg);
+            this->push(msg);
         }
         
         return this->pop(subscriber);
     }
 
 public:
-    template<unsigned int N> message_pool(T (&arr)[N]) noexcept : 
+    template<unsigned int N> constexpr message_pool(T (&arr)[N]) noexcept : 
         items_array(&arr[0]), 
         array_length(sizeof(arr) / sizeof(arr[0])), 
         offset(0) {}
 
-    option<owner<T>> alloc() {
-        auto msg = try_pick_from_array();
-        
-        if (!msg) {
-            return this->try_pop();            
+#if defined MG_STATS
+    pool_stats alloc_stats = {};
+#endif
+
+    // Fresh array item or recycled one, in a single critical section.
+    owner<T> alloc() {
+        locked_region region(this->lock, lock_site::pool);
+        owner<T> msg = pick_from_array();
+
+        if (msg) {
+            this->departed(*msg);
+        } else {
+            msg = owner<T>(this->try_pop_locked());
         }
+#if defined MG_STATS
+        const unsigned int used = array_length - free_items();
 
+        if (msg) {
+            alloc_stats.peak = used > alloc_stats.peak ? used : alloc_stats.peak;
+        } else {
+            ++alloc_stats.failures;
+        }
+#endif
         return msg;
     }
+
+    std::size_t available() {
+        locked_region region(this->lock, lock_site::pool);
+        return free_items();
+    }
     
     friend class actor; 
 };
 
+/*
+ * Pool owning its messages. All of them are linked into the free list by
+ * the constexpr constructor so a constinit pool is emitted into .data 
+ * ready to use and both alloc and get are a single dequeue.
+ */
+template<class T, std::size_t N> class static_pool : public queue<T> {
+    T items[N] = {};
+
+protected:
+    inline auto get(actor& subscriber) {
+        return this->pop(subscriber);
+    }
+
+public:
+    constexpr static_pool() noexcept {
+        for (T& item : items) {
+            this->prefill(item);
+        }
+    }
+
+#if defined MG_STATS
+    pool_stats alloc_stats = {};
+#endif
+
+    owner<T> alloc() {
+        locked_region region(this->lock, lock_site::pool);
+        owner<T> msg = owner<T>(this->try_pop_locked());
+#if defined MG_STATS
+        const unsigned int used = N - this->count();
+
+        if (msg) {
+            alloc_stats.peak = used > alloc_stats.peak ? used : alloc_stats.peak;
+        } else {
+            ++alloc_stats.failures;
+        }
+#endif
+        return msg;
+    }
+
+    std::size_t available() {
+        locked_region region(this->lock, lock_site::pool);
+        return this->count();
+    }
+
+    friend class actor;
+};
+
+/*
+ * Storage block of a slab size class with Size bytes after the message
+ * header, so the size classes don't depend on the options which grow the
+ * header. Any message type of size up to sizeof(slab_block<Size>) may be
+ * constructed in place of the block. Message types must derive from 
+ * 'message' as their first base so the block and the message share the 
+ * address.
+ */
+template<std::size_t Size> struct alignas(std::max_align_t) slab_block : 
+    public message {
+    static_assert(Size != 0, "block is too small");
+    unsigned char payload[Size];
+};
+
+#if defined MG_STATS
+struct slab_class_stats {
+    std::size_t capacity;
+    std::size_t peak;       // high-watermark of blocks in use
+    std::size_t allocs;
+    std::size_t fallbacks;  // served here because smaller classes were empty
+    std::size_t max_slack;  // worst unused tail of a block in bytes
+};
+#endif
+
+/*
+ * Pool of several size classes shared by many message types. Each class is
+ * an ordinary message_pool of blocks so a dropped message returns to its
+ * class via 'parent'. Allocation takes the smallest class fitting the type
+ * and falls back to larger ones when it is exhausted.
+ */
+template<std::size_t... Sizes> class slab_pool {
+    static constexpr std::size_t classes = sizeof...(Sizes);
+    static constexpr std::array<std::size_t, classes> block_size = {
+        sizeof(slab_block<Sizes>)...
+    };
+    
+    static constexpr bool is_sorted() {
+        for (std::size_t i = 1; i < classes; ++i) {
+            if (block_size[i - 1] >= block_size[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static_assert(classes != 0 && is_sorted(), "sizes must be ascending");
+
+    std::tuple<message_pool<slab_block<Sizes>>...> pools;
+#if defined MG_STATS
+    mutex lock;
+    std::array<slab_class_stats, classes> class_stats;
+    std::size_t fail_count = 0;
+#endif
+
+    template<class T, std::size_t I> inline void account(bool fallback) {
+#if defined MG_STATS
+        // Read before taking the lock since the class pool locks itself.
+        const std::size_t left = std::get<I>(pools).available();
+        locked_region region(lock, lock_site::pool);
+        auto& s = class_stats[I];
+        const std::size_t used = s.capacity - left;
+        const std::size_t slack = block_size[I] - sizeof(T);
+
+        ++s.allocs;
+        s.fallbacks += fallback ? 1 : 0;
+        s.peak = used > s.peak ? used : s.peak;
+        s.max_slack = slack > s.max_slack ? slack : s.max_slack;
+#else
+        (void)fallback;
+#endif
+    }
+
+    template<class T, std::size_t I = 0> T* take(bool fallback = false) {
+        if constexpr (I == classes) {
+            return nullptr;
+        } else if constexpr (sizeof(T) > block_size[I]) {
+            return take<T, I + 1>(fallback);
+        } else {
+            if (auto block = std::get<I>(pools).alloc()) {
+                auto* const raw = block.release();
+                queue_base* const parent = raw->parent;
+#if defined MG_MESSAGE_STATS
+                const std::uint32_t born = raw->born;
+#endif
+                T* const object = ::new (static_cast<void*>(raw)) T;
+                object->parent = parent;
+#if defined MG_MESSAGE_STATS
+                object->born = born;
+#endif
+                account<T, I>(fallback);
+                return object;
+            }
+
+            return take<T, I + 1>(true);
+        }
+    }
+
+public:
+    template<class... A> constexpr slab_pool(A&... arr) noexcept : 
+        pools(arr...)
+#if defined MG_STATS
+        , class_stats{ slab_class_stats{ std::extent_v<A>, 0, 0, 0, 0 }... }
+#endif
+        {
+        static_assert(
+            (std::is_same_v<std::remove_extent_t<A>, slab_block<Sizes>> && ...),
+            "arrays of blocks must be given in the order of size classes"
+        );
+    }
+
+    template<class T> owner<T> alloc() {
+        static_assert(std::is_base_of_v<message, T>, "not a message type");
+        static_assert(sizeof(T) <= block_size[classes - 1], "too large");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "misaligned");
+
+        T* const object = take<T>();
+
+        if (object == nullptr) {
+#if defined MG_STATS
+            locked_region region(lock, lock_site::pool);
+            ++fail_count;
+#endif
+            return nullptr;
+        }
+
+        return owner(object);
+    }
+
+#if defined MG_STATS
+    inline const slab_class_stats& stats(std::size_t i) const {
+        return class_stats[i];
+    }
+
+    inline std::size_t failures() const {
+        return fail_count;
+    }
+#endif
+};
+
+template<std::size_t... S, std::size_t... N> 
+slab_pool(slab_block<S> (&...arr)[N]) -> slab_pool<S...>;
+
 class timer {
     mutex lock;
     std::array<list, MG_TIMERQ_MAX> subscribers;
-    std::array<size_t, MG_TIMERQ_MAX> length;
-    unsigned int ticks;
+    std::array<size_t, MG_TIMERQ_MAX> length = {};
+    unsigned int ticks = 0;
     static timer context;
 
     static unsigned int diff_msb(unsigned int a, unsigned int b) {
@@ -364,9 +2251,13 @@ class timer {
     }
     
 public:
+    static inline unsigned int now() {
+        return context.ticks;
+    }
+
     static void subscribe(actor& subscriber, unsigned int delay) {
         //TODO: assert(delay < INT32_MAX);
-        locked_region region(context.lock);
+        locked_region region(context.lock, lock_site::timer_subscribe);
         const unsigned int timeout = context.ticks + delay;
         const unsigned q = diff_msb(context.ticks, timeout);
         subscriber.timeout = timeout;
@@ -388,15 +2279,21 @@ public:
                 return false;
             }
             
-            void await_suspend(std::coroutine_handle<> h) const noexcept {
-                subscriber.set_handle(h);
+            suspend_result await_suspend(
+                std::coroutine_handle<> h
+            ) const noexcept {
+                actor& a = subscriber;
+                const unsigned int prio = a.prio;
+                a.set_handle(h, actor_state::sleep, nullptr);
 
                 if (delay != 0) {
-                    timer::subscribe(subscriber, delay);
+                    timer::subscribe(a, delay);
                 } else {
-                    auto subscr_owner = owner(&subscriber);
+                    auto subscr_owner = owner(&a);
                     scheduler::activate(subscr_owner);
                 }
+
+                return scheduler::transfer(&a, prio, true, h);
             }
             
             void await_resume() const noexcept {}
@@ -405,30 +2302,41 @@ public:
         return awaitable(subscriber, delay);
     }
     
+    // Expired actors are activated after the lock is released since the 
+    // lock doesn't nest.
     static void tick() {
-        locked_region region(context.lock);
-        const auto prev_tick = context.ticks++;
-        const unsigned q = diff_msb(prev_tick, context.ticks);
-        const unsigned int len = context.length[q];
-        
-        context.length[q] = 0;
-
-        for (unsigned int i = 0; i < len; ++i) {
-            option<owner<actor>> item = context.subscribers[q].dequeue<actor>();
-            const unsigned int timeout = (*item)->timeout;
+        list expired;
+        {
+            locked_region region(context.lock, lock_site::timer_tick);
+            const auto prev_tick = context.ticks++;
+            trace_buffer::record(trace_event::tick, nullptr, context.ticks);
+            const unsigned q = diff_msb(prev_tick, context.ticks);
+            const unsigned int len = context.length[q];
             
-            if (timeout == context.ticks) {
-                scheduler::activate(*item);
-            } else {
-                const unsigned next = diff_msb(timeout, context.ticks);;
-                context.subscribers[next].enqueue(*item);
-                ++(context.length[next]);
+            context.length[q] = 0;
+
+            for (unsigned int i = 0; i < len; ++i) {
+                owner<actor> item = context.subscribers[q].dequeue<actor>();
+                const unsigned int timeout = item->timeout;
+                
+                if (timeout == context.ticks) {
+                    expired.enqueue(item);
+                } else {
+                    const unsigned next = diff_msb(timeout, context.ticks);
+                    context.subscribers[next].enqueue(item);
+                    ++(context.length[next]);
+                }
             }
-            // TODO: interrupt window.
+        }
+
+        while (owner<actor> item = expired.dequeue<actor>()) {
+            scheduler::activate(item);
         }
     }
 };
 
+inline constinit timer timer::context;
+
 template<class T> inline auto actor::poll(queue<T>& q) {
     return q.pop(*this);
 }
@@ -437,21 +2345,75 @@ template<class T> inline auto actor::get(message_pool<T>& p) {
     return p.get(*this);
 }
 
+template<class T, std::size_t N> inline auto actor::get(static_pool<T, N>& p) {
+    return p.get(*this);
+}
+
+inline void actor::set_state(actor_state state, const void* object) {
+#if defined MG_INTROSPECTION
+    const unsigned int now = timer::now();
+    info.object = object;
+    info.since = now;
+    info.state = state;
+
+    if (state == actor_state::running) {
+        info.last_run = now;
+    }
+#else
+    (void)state;
+    (void)object;
+#endif
+}
+
 inline auto actor::sleep(unsigned int delay) {
     return timer::sleep(*this, delay);
 }
 
+inline auto actor::wait(semaphore& s) {
+    return s.wait(*this);
+}
+
+inline auto actor::wait(event_flags& e, unsigned int mask) {
+    return e.wait(*this, mask);
+}
+
+template<unsigned int V> inline auto actor::irq() {
+    return interrupt<V>::wait(*this);
+}
+
+inline auto actor::lock(async_mutex& m) {
+    return m.acquire(*this);
+}
+
+inline auto actor::unlock(async_mutex& m) {
+    return m.release(*this);
+}
+
 template<class T> void owner<T>::drop(T* ptr) {
     message* m = static_cast<message*>(ptr);
-    queue<T>* q = static_cast<queue<T>*>(m->parent);
-    owner<T> msg = owner(ptr);
+#if defined MG_LOCKFREE_POOL
+    if (m->parent->lockfree) {
+        static_cast<free_list*>(m->parent)->free(m);
+        return;
+    }
+#endif
+    message_queue* q = static_cast<message_queue*>(m->parent);
+    owner<message> msg(m);
     q->push(msg);
 }
 
-template<> void owner<actor>::drop(actor* a) {
+inline void work_item::post() {
+    scheduler::post(*this);
+}
+
+template<> inline void owner<actor>::drop(actor*) {
     //TODO: assert actor never dropped
 }
 
+template<> inline void owner<runnable>::drop(runnable*) {}
+
+template<> inline void owner<work_item>::drop(work_item*) {}
+
 };
 
 #endif
@@ -0,0 +1,460 @@
+/**
+  ******************************************************************************
+  *  @file   main.cpp
+  *  @brief  Randomized scheduling stress run of magnesium on the simulated
+  *          interrupt controller. Usage: sim [seed] [points] [rate]
+  ******************************************************************************
+  *  License: Public domain.
+  *****************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "magnesium.hpp"
+
+using namespace magnesium;
+
+enum : unsigned int {
+    TICK_VECTOR,
+    PRODUCER_A_VECTOR,
+    STAGE2_VECTOR,
+    SLEEPER_VECTOR,
+    PRODUCER_B_VECTOR,
+    STAGE1_VECTOR,
+    WORK_VECTOR
+};
+
+const unsigned int PRODUCERS = 2;
+const unsigned int POOL_SIZE = 8;
+const unsigned int MAX_DELAY = 300;
+const unsigned int EV_TICK = 1U << 0;
+const unsigned int EV_DATA = 1U << 1;
+
+static void tick_handler();
+static void producer_a_handler();
+static void producer_b_handler();
+static void stage2_handler();
+static void sleeper_handler();
+static void stage1_handler();
+static void work_handler();
+
+constinit nvic_sim::controller nvic_sim::nvic({
+    { tick_handler, 0, true },
+    { producer_a_handler, 1, true },
+    { stage2_handler, 2, false },
+    { sleeper_handler, 3, false },
+    { producer_b_handler, 4, true },
+    { stage1_handler, 5, false },
+    { work_handler, 6, false },
+});
+
+using nvic_sim::nvic;
+
+void* magnesium::future::promise_type::allocate(std::size_t n) {
+    alignas(std::max_align_t) static std::uint8_t buffer[2048];
+    static std::size_t ptr = 0;
+    const std::size_t old_ptr = ptr;
+    ptr += (n + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+    if (ptr > sizeof(buffer)) {
+        std::fputs("coroutine frame buffer is too small\n", stderr);
+        std::abort();
+    }
+
+    return buffer + old_ptr;
+}
+
+static struct seq_msg : public message {
+    unsigned int producer;
+    unsigned int seq;
+} g_msgs[POOL_SIZE];
+
+// Producer A runs in a handler, so its pool is lock-free when available.
+#if defined MG_LOCKFREE_POOL
+static lockfree_pool g_pool(g_msgs);
+#else
+static message_pool g_pool(g_msgs);
+#endif
+static slab_block<64> g_small[3];
+static slab_block<96> g_large[2];
+static slab_pool g_slab(g_small, g_large);
+constinit static queue<seq_msg> g_input;
+constinit static queue<seq_msg> g_forward;
+constinit static event_flags g_events;
+constinit static semaphore g_sem;
+constinit static async_mutex g_bus(STAGE2_VECTOR);
+static actor* g_bus_holder = nullptr;
+
+static struct {
+    unsigned int produced[PRODUCERS];
+    unsigned int stage1_next[PRODUCERS];
+    unsigned int stage2_next[PRODUCERS];
+    unsigned int sink_next[PRODUCERS];
+    unsigned long consumed;
+    unsigned long exhausted;
+    unsigned long ticks;
+    unsigned long wakes;
+    unsigned int max_lateness;
+    unsigned long posts;
+    unsigned long work_calls;
+    unsigned long events;
+    unsigned long signals;
+    unsigned long takes;
+    unsigned long locks;
+    unsigned long contended;
+    unsigned long refused;
+    std::uint64_t digest;
+} g_stats;
+
+static void expect_priority(unsigned int vect, const char* what) {
+    if (nvic.running() != nvic.priority(vect)) {
+        nvic.fail(what);
+    }
+}
+
+static void check_order(unsigned int (&next)[PRODUCERS], const seq_msg& msg,
+    const char* what) {
+    if (msg.producer >= PRODUCERS || msg.seq != next[msg.producer]++) {
+        nvic.fail(what);
+    }
+}
+
+class stage1_actor : public static_actor<stage1_actor> {
+public:
+    stage1_actor(unsigned int vect) noexcept : static_actor(vect) {}
+
+    future run() {
+        for(;;) {
+            auto msg = co_await poll(g_input);
+            expect_priority(STAGE1_VECTOR, "stage 1 runs at wrong priority");
+            check_order(g_stats.stage1_next, *msg, "stage 1 order broken");
+            g_forward.push(msg);
+        }
+    }
+};
+
+// The last stage owns its mailbox, stage 2 sends to it directly.
+class sink_actor : public mailbox_actor<sink_actor, seq_msg> {
+public:
+    sink_actor(unsigned int vect) noexcept : mailbox_actor(vect) {}
+
+    future run() {
+        for(;;) {
+            auto msg = co_await receive();
+            expect_priority(SLEEPER_VECTOR, "sink runs at wrong priority");
+            check_order(g_stats.sink_next, *msg, "sink order broken");
+            ++g_stats.consumed;
+            g_stats.digest = (g_stats.digest ^ (msg->producer << 24 | msg->seq))
+                * 0x100000001b3ULL;
+        }
+    }
+};
+
+static sink_actor g_sink(SLEEPER_VECTOR);
+
+class stage2_actor : public static_actor<stage2_actor> {
+public:
+    stage2_actor(unsigned int vect) noexcept : static_actor(vect) {}
+
+    future run() {
+        for(;;) {
+            auto msg = co_await poll(g_forward);
+            expect_priority(STAGE2_VECTOR, "stage 2 runs at wrong priority");
+            check_order(g_stats.stage2_next, *msg, "stage 2 order broken");
+            g_sink.send(msg);
+        }
+    }
+};
+
+/*
+ * Sleeps for pseudo-random delays. A tick may land between reading the
+ * time and subscribing, so waking late is allowed but early is not.
+ */
+class sleeper_actor : public static_actor<sleeper_actor> {
+    std::uint32_t state;
+
+public:
+    sleeper_actor(unsigned int vect, std::uint32_t seed) noexcept :
+        static_actor(vect),
+        state(seed) {}
+
+    future run() {
+        for(;;) {
+            state = state * 1664525U + 1013904223U;
+            const unsigned int delay = (state >> 16) % MAX_DELAY;
+            const unsigned int start = timer::now();
+
+            co_await sleep(delay);
+            expect_priority(vect, "sleeper runs at wrong priority");
+            const unsigned int late = timer::now() - start - delay;
+
+            if (static_cast<int>(late) < 0) {
+                nvic.fail("sleeper woke early");
+            } else if (late > g_stats.max_lateness) {
+                g_stats.max_lateness = late;
+            }
+            ++g_stats.wakes;
+        }
+    }
+};
+
+/*
+ * Waits for event flags. Several waiters with overlapping masks share the
+ * flags, a wakeup must deliver some bits of the mask and nothing else.
+ */
+template<unsigned int M> class flag_actor : public static_actor<flag_actor<M>> {
+public:
+    flag_actor(unsigned int vect) noexcept : static_actor<flag_actor<M>>(vect) {}
+
+    future run() {
+        for(;;) {
+            const unsigned int bits = co_await this->wait(g_events, M);
+            expect_priority(this->vect, "flag waiter runs at wrong priority");
+
+            if (bits == 0 || (bits & ~M) != 0) {
+                nvic.fail("event bits outside of the mask");
+            }
+            ++g_stats.events;
+        }
+    }
+};
+
+// Takes the count signalled by producer B.
+class sem_actor : public static_actor<sem_actor> {
+public:
+    sem_actor(unsigned int vect) noexcept : static_actor(vect) {}
+
+    future run() {
+        for(;;) {
+            co_await wait(g_sem);
+            expect_priority(vect, "semaphore waiter runs at wrong priority");
+            ++g_stats.takes;
+        }
+    }
+};
+
+/*
+ * Users of the priority ceiling mutex at and below the ceiling. The holder
+ * must run at the ceiling priority, also after sleeping with the mutex held,
+ * and return to its home priority after unlock. Unlock without holding the
+ * mutex must be refused. Two users below the ceiling share a vector, so
+ * the holder often hands the mutex over to a waiter which must migrate.
+ */
+class lock_actor : public static_actor<lock_actor> {
+    const unsigned int home;
+    std::uint32_t state;
+
+public:
+    unsigned long held = 0;
+
+    lock_actor(unsigned int vect, std::uint32_t seed) noexcept :
+        static_actor(vect),
+        home(vect),
+        state(seed) {}
+
+    future run() {
+        for(;;) {
+            state = state * 1664525U + 1013904223U;
+            co_await sleep((state >> 16) % 8);
+
+            ++g_stats.refused;
+            co_await unlock(g_bus);
+            expect_priority(home, "refused unlock changed priority");
+
+            g_stats.contended += g_bus_holder != nullptr ? 1 : 0;
+            co_await lock(g_bus);
+            expect_priority(STAGE2_VECTOR, "mutex holder below the ceiling");
+
+            if (g_bus_holder != nullptr) {
+                nvic.fail("mutex held twice");
+            }
+            g_bus_holder = this;
+            ++g_stats.locks;
+            ++held;
+
+            co_await sleep((state >> 24) % 2);
+            expect_priority(STAGE2_VECTOR, "mutex holder woke below the ceiling");
+
+            g_bus_holder = nullptr;
+            co_await unlock(g_bus);
+            expect_priority(home, "mutex holder didn't return home");
+        }
+    }
+};
+
+static stage1_actor g_stage1(STAGE1_VECTOR);
+static stage2_actor g_stage2(STAGE2_VECTOR);
+static sleeper_actor g_sleeper(SLEEPER_VECTOR, 1);
+static sleeper_actor g_low_sleeper(STAGE1_VECTOR, 2);  // shares stage 1 queue
+static flag_actor<EV_TICK | EV_DATA> g_any_flags(SLEEPER_VECTOR);
+static flag_actor<EV_DATA> g_data_flags(STAGE1_VECTOR);
+static flag_actor<EV_TICK> g_tick_flags(STAGE2_VECTOR);
+static sem_actor g_sem_waiter(STAGE1_VECTOR);
+static lock_actor g_lock_ceiling(STAGE2_VECTOR, 3);
+static lock_actor g_lock_a(SLEEPER_VECTOR, 4);
+static lock_actor g_lock_b(SLEEPER_VECTOR, 5);
+static work_item g_work(WORK_VECTOR, [](work_item&) {
+    expect_priority(WORK_VECTOR, "work item runs at wrong priority");
+    ++g_stats.work_calls;
+});
+
+// Producer A allocates from the pool, producer B from the slab.
+static void produce(unsigned int id) {
+    auto msg = id == 0 ? g_pool.alloc() : g_slab.alloc<seq_msg>();
+
+    if (!msg) {
+        ++g_stats.exhausted;
+        return;
+    }
+
+    msg->producer = id;
+    msg->seq = g_stats.produced[id]++;
+    g_input.push(msg);
+}
+
+static void tick_handler() {
+    ++g_stats.ticks;
+    timer::tick();
+    g_events.set(EV_TICK);
+}
+
+static void producer_a_handler() {
+    produce(0);
+    g_events.set(EV_DATA);
+}
+
+static void producer_b_handler() {
+    produce(1);
+    ++g_stats.posts;
+    g_work.post();
+    ++g_stats.signals;
+    g_sem.signal();
+}
+
+static void stage2_handler() {
+    scheduler::schedule(STAGE2_VECTOR);
+}
+
+static void sleeper_handler() {
+    scheduler::schedule(SLEEPER_VECTOR);
+}
+
+static void stage1_handler() {
+    scheduler::schedule(STAGE1_VECTOR);
+}
+
+static void work_handler() {
+    scheduler::schedule(WORK_VECTOR);
+}
+
+int main(int argc, char** argv) {
+    const std::uint64_t seed = argc > 1 ? std::strtoull(argv[1], nullptr, 0) : 1;
+    const std::uint64_t points = argc > 2 ? std::strtoull(argv[2], nullptr, 0) : 1000000;
+    const unsigned int rate = argc > 3 ? std::strtoul(argv[3], nullptr, 0) : 16;
+    const auto start = std::chrono::steady_clock::now();
+
+    mg_port_timestamp_init();
+    g_stage1.start();
+    g_stage2.start();
+    g_sleeper.start();
+    g_low_sleeper.start();
+    g_any_flags.start();
+    g_data_flags.start();
+    g_tick_flags.start();
+    g_sink.start();
+    g_sem_waiter.start();
+    g_lock_ceiling.start();
+    g_lock_a.start();
+    g_lock_b.start();
+    nvic.configure(seed, rate, points);
+
+    while (!nvic.exhausted()) {
+        nvic.point();
+        scheduler::idle();
+    }
+
+    nvic.drain();
+
+    unsigned long produced = 0;
+
+    for (unsigned int id = 0; id < PRODUCERS; ++id) {
+        produced += g_stats.produced[id];
+
+        if (g_stats.stage1_next[id] != g_stats.produced[id] ||
+            g_stats.stage2_next[id] != g_stats.produced[id] ||
+            g_stats.sink_next[id] != g_stats.produced[id]) {
+            nvic.fail("message lost");
+        }
+    }
+
+    if (g_pool.available() != POOL_SIZE) {
+        nvic.fail("pool leaked");
+    }
+
+    {
+        owner<seq_msg> blocks[std::size(g_small) + std::size(g_large)];
+
+        for (auto& block : blocks) {
+            block = g_slab.alloc<seq_msg>();
+
+            if (!block) {
+                nvic.fail("slab leaked");
+            }
+        }
+    }
+
+    if (g_stats.takes != g_stats.signals) {
+        nvic.fail("semaphore takes don't match signals");
+    }
+
+    // A user sent to a wrong vector is never resumed again. Vectors below
+    // the sleeper may starve under heavy injection, the users are above.
+    if (g_stats.ticks > 100 &&
+        (!g_lock_ceiling.held || !g_lock_a.held || !g_lock_b.held)) {
+        nvic.fail("mutex user stuck");
+    }
+
+#if defined MG_STATS
+    if (g_bus.stats.refused != g_stats.refused) {
+        nvic.fail("refused unlocks not counted");
+    }
+#endif
+
+    if (g_stats.work_calls > g_stats.posts || (g_stats.posts && !g_stats.work_calls)) {
+        nvic.fail("work item calls don't match posts");
+    }
+
+    const double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::printf("seed %llu rate 1/%u\n",
+        static_cast<unsigned long long>(seed), rate);
+    std::printf("points %llu, injected %llu, handled %llu, %.0f points/s\n",
+        static_cast<unsigned long long>(nvic.points),
+        static_cast<unsigned long long>(nvic.injected),
+        static_cast<unsigned long long>(nvic.handled),
+        seconds > 0 ? nvic.points / seconds : 0.0);
+    std::printf("messages %lu, consumed %lu, pool exhausted %lu\n",
+        produced, g_stats.consumed, g_stats.exhausted);
+    std::printf("ticks %lu, wakes %lu, max lateness %u\n",
+        g_stats.ticks, g_stats.wakes, g_stats.max_lateness);
+    std::printf("work posts %lu, calls %lu, events %lu\n",
+        g_stats.posts, g_stats.work_calls, g_stats.events);
+    std::printf("semaphore signals %lu, takes %lu\n",
+        g_stats.signals, g_stats.takes);
+    std::printf("mutex locks %lu, contended %lu\n",
+        g_stats.locks, g_stats.contended);
+    std::printf("nested locks %llu\n",
+        static_cast<unsigned long long>(nvic.nested_locks));
+    std::printf("digest %016llx\n",
+        static_cast<unsigned long long>(g_stats.digest));
+
+    if (nvic.violations) {
+        std::printf("violations %llu, first: %s\n",
+            static_cast<unsigned long long>(nvic.violations),
+            nvic.first_violation);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,31 @@
+/** 
+  * @file  mg_port.h
+  * @brief Host port running on the simulated interrupt controller.
+  * License: Public domain. The code is provided as is without any warranty.
+  */
+#ifndef _MG_PORT_H_
+#define _MG_PORT_H_
+
+#include "nvic_sim.hpp"
+
+#if !defined MG_PRIO_MAX
+#define MG_PRIO_MAX 8
+#endif 
+
+#if !defined MG_TIMERQ_MAX
+#define MG_TIMERQ_MAX 10
+#endif
+
+#define mg_port_clz(x) __builtin_clz(x)
+
+#define mg_object_lock(p) { nvic_sim::nvic.lock(); }
+#define mg_object_unlock(p) { nvic_sim::nvic.unlock(); }
+#define mg_port_sleep() { nvic_sim::nvic.sleep(); }
+
+#define pic_vect2prio(v) (nvic_sim::nvic.priority(v))
+#define pic_interrupt_request(v) (nvic_sim::nvic.request(v))
+
+#define mg_port_timestamp_init() {}
+#define mg_port_timestamp() (nvic_sim::nvic.timestamp())
+
+#endif
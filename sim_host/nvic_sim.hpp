@@ -0,0 +1,207 @@
+/**
+  * @file  nvic_sim.hpp
+  * @brief Deterministic single-threaded model of the Cortex-M interrupt
+  *        controller for running magnesium on the host.
+  * License: Public domain. The code is provided as is without any warranty.
+  */
+#ifndef _NVIC_SIM_HPP_
+#define _NVIC_SIM_HPP_
+
+#include <cstdint>
+#include <cstddef>
+
+namespace nvic_sim {
+
+const unsigned int VECTORS = 32;
+
+struct vector {
+    void (*handler)();
+    unsigned int prio;      // lower value is more urgent, as on the NVIC
+    bool source;            // hardware interrupt raised at injection points
+};
+
+/*
+ * Handlers run nested on the host stack when a pending vector is more urgent
+ * than the running one and interrupts aren't masked, the same way exceptions
+ * preempt on Cortex-M. Equal priorities don't preempt, pending vectors of the
+ * same priority are taken in vector order.
+ *
+ * Hardware interrupts are raised only at injection points: every lock and
+ * unlock of the framework (just before masking and just after unmasking)
+ * and explicit point() calls of the application. A seeded xorshift decides
+ * at each point whether and which source fires, so a seed replays exactly
+ * the same interleaving. Injection stops when the budget of points is
+ * spent, so nested handlers can't keep the run going forever. The clock 
+ * advances by one per point and serves as mg_port_timestamp().
+ *
+ * The port lock masks interrupts like cpsid/cpsie and doesn't nest: taking
+ * it while masked is a violation since the inner unlock would unmask
+ * interrupts in the middle of the outer critical section.
+ */
+class controller {
+    vector table[VECTORS] = {};
+    std::uint32_t pending = 0;
+    std::uint32_t sources = 0;
+    unsigned int active = IDLE;
+    bool masked = false;
+    std::uint64_t state = 1;
+    unsigned int rate = 0;
+    std::uint64_t budget = 0;
+
+    std::uint32_t random() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return static_cast<std::uint32_t>(state >> 32);
+    }
+
+    void inject() {
+        unsigned int n = random() % __builtin_popcount(sources);
+        std::uint32_t set = sources;
+
+        while (n--) {
+            set &= set - 1;
+        }
+
+        pending |= set & -set;
+        ++injected;
+    }
+
+    int next() const {
+        int best = -1;
+
+        for (unsigned int v = 0; v < VECTORS; ++v) {
+            if ((pending & (1U << v)) && table[v].prio < active &&
+                (best < 0 || table[v].prio < table[best].prio)) {
+                best = static_cast<int>(v);
+            }
+        }
+
+        return best;
+    }
+
+    void dispatch() {
+        int v;
+
+        while (!masked && (v = next()) >= 0) {
+            const unsigned int preempted = active;
+            pending &= ~(1U << v);
+            active = table[v].prio;
+            ++handled;
+            table[v].handler();
+
+            if (masked) {
+                fail("handler returned with interrupts masked");
+                masked = false;
+            }
+
+            active = preempted;
+        }
+    }
+
+public:
+    static const unsigned int IDLE = ~0U;
+
+    std::uint64_t clock = 0;
+    std::uint64_t points = 0;
+    std::uint64_t injected = 0;
+    std::uint64_t handled = 0;
+    std::uint64_t nested_locks = 0;     // lock while already masked
+    std::uint64_t violations = 0;
+    const char* first_violation = nullptr;
+
+    template<std::size_t N> constexpr controller(const vector (&t)[N]) {
+        static_assert(N <= VECTORS, "too many vectors");
+
+        for (std::size_t v = 0; v < N; ++v) {
+            table[v] = t[v];
+            sources |= t[v].source ? 1U << v : 0;
+        }
+    }
+
+    // Rate 0 disables injection, otherwise a source fires with 1/rate chance
+    // at each of the first 'limit' points.
+    void configure(std::uint64_t seed, unsigned int r, std::uint64_t limit) {
+        state = seed ? seed : 1;
+        rate = r;
+        budget = limit;
+    }
+
+    inline bool exhausted() const {
+        return points >= budget;
+    }
+
+    inline unsigned int priority(unsigned int v) const {
+        return table[v].prio;
+    }
+
+    // Execution priority, IDLE in the background.
+    inline unsigned int running() const {
+        return active;
+    }
+
+    inline std::uint32_t timestamp() const {
+        return static_cast<std::uint32_t>(clock);
+    }
+
+    void request(unsigned int v) {
+        pending |= 1U << v;
+        dispatch();
+    }
+
+    void point() {
+        ++clock;
+        ++points;
+
+        if (rate && sources && !exhausted() && random() % rate == 0) {
+            inject();
+        }
+
+        dispatch();
+    }
+
+    void lock() {
+        point();
+
+        if (masked) {
+            ++nested_locks;
+            fail("nested lock");
+        }
+
+        masked = true;
+    }
+
+    void unlock() {
+        masked = false;
+        point();
+    }
+
+    // WFI: time passes until some source fires.
+    void sleep() {
+        clock += 100;
+
+        if (!pending && sources && !exhausted()) {
+            inject();
+        }
+
+        dispatch();
+    }
+
+    // Runs everything pending with injection disabled.
+    void drain() {
+        rate = 0;
+        dispatch();
+    }
+
+    void fail(const char* what) {
+        if (!violations++) {
+            first_violation = what;
+        }
+    }
+};
+
+extern controller nvic;
+
+}
+
+#endif
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""
+Decoder of magnesium scheduler trace (MG_TRACE) into Chrome/Perfetto JSON.
+
+Dump the trace object with a debugger, e.g. in gdb:
+
+    dump binary value trace.bin magnesium::trace_buffer::context
+
+and convert it:
+
+    arm-none-eabi-nm -C demo.elf > demo.sym
+    mg_trace.py trace.bin --sym demo.sym --clock 72000000 > trace.json
+
+The result can be opened in chrome://tracing or ui.perfetto.dev.
+License: Public domain. The code is provided as is without any warranty.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+EVENTS = {
+    1: 'activate',
+    2: 'post',
+    3: 'schedule_enter',
+    4: 'schedule_exit',
+    5: 'execute',
+    6: 'transfer',
+    7: 'push',
+    8: 'pop',
+    9: 'pop_wait',
+    10: 'tick',
+}
+
+RECORD = struct.Struct('<IHBB')
+HEADER = struct.Struct('<II')
+
+
+def read_records(data):
+    head, length = HEADER.unpack_from(data, 0)
+    count = min(head, length)
+    records = []
+
+    for i in range(head - count, head):
+        offset = HEADER.size + (i % length) * RECORD.size
+        time, ident, event, arg = RECORD.unpack_from(data, offset)
+
+        if event in EVENTS:
+            records.append((time, ident, EVENTS[event], arg))
+
+    return records
+
+
+def read_symbols(path):
+    """Maps low 16 bits of addresses to names from 'nm' output."""
+    symbols = {}
+
+    with open(path) as f:
+        for line in f:
+            parts = line.split(None, 2)
+
+            if len(parts) == 3 and parts[1] in 'bBdD':
+                symbols[int(parts[0], 16) & 0xffff] = parts[2].strip()
+
+    return symbols
+
+
+def convert(records, symbols, clock):
+    events = []
+    loops = []          # vectors of the nested scheduler loops
+    running = {}        # vector -> name of the open runnable slice
+    time = 0
+    last = None
+
+    def name(ident):
+        return symbols.get(ident, '0x%04x' % ident)
+
+    def emit(ph, tid, label, **extra):
+        e = {'ph': ph, 'pid': 1, 'tid': tid, 'name': label,
+             'ts': time * 1e6 / clock}
+        e.update(extra)
+        events.append(e)
+
+    def close(vect):
+        if vect in running:
+            emit('E', vect, running.pop(vect))
+
+    for stamp, ident, event, arg in records:
+        if last is not None:
+            delta = (stamp - last) & 0xffffffff
+            time += delta - (1 << 32) if delta & 0x80000000 else delta
+
+        last = stamp
+        tid = loops[-1] if loops else 'other'
+
+        if event == 'schedule_enter':
+            loops.append(arg)
+            emit('B', arg, 'vector %d' % arg)
+        elif event == 'schedule_exit':
+            if arg in loops:
+                close(arg)
+                emit('E', arg, 'vector %d' % arg)
+                loops.remove(arg)
+        elif event in ('execute', 'transfer'):
+            close(tid)
+            running[tid] = name(ident)
+            emit('B', tid, running[tid])
+        else:
+            emit('i', tid, '%s %s' % (event, name(ident)), s='t',
+                 args={'arg': arg})
+
+    return {'traceEvents': events, 'displayTimeUnit': 'ns'}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[1])
+    parser.add_argument('dump', help='binary dump of trace_buffer::context')
+    parser.add_argument('--sym', help='output of nm for object names')
+    parser.add_argument('--clock', type=float, default=1e6,
+                        help='timestamp frequency in Hz (default 1 MHz)')
+    args = parser.parse_args()
+
+    with open(args.dump, 'rb') as f:
+        records = read_records(f.read())
+
+    symbols = read_symbols(args.sym) if args.sym else {}
+    json.dump(convert(records, symbols, args.clock), sys.stdout, indent=1)
+
+
+if __name__ == '__main__':
+    main()